@@ -33,7 +33,8 @@
 //   When audio/non-audio mode has been toggled, you will see three green blinks.
 //
 //   Brightness, selected effect, and auto-cycle are saved in EEPROM after a delay
-//   The RGB Shades will automatically start up with the last-selected settings
+//   The RGB Shades will automatically start up with the last-selected settings,
+//   and with the audio gain and tempo they had learned
 
 // RGB Shades data output to LEDs is on pin 5
 #define LED_PIN  5
@@ -44,7 +45,14 @@
 
 // Global maximum brightness value, maximum 255
 #define MAXBRIGHTNESS 72
-#define STARTBRIGHTNESS 2
+#define STARTBRIGHTNESS 2 // brightVals level a long press of the brightness button resets to
+#define BOOTBRIGHTNESS 3  // level at first power-up, before any is saved
+
+// Current limit for the LEDs in mA; brighter frames are scaled down to fit
+#define MAXMILLIAMPS 1000
+
+// Comment out for linear output (no gamma correction of pixel values)
+#define GAMMACORRECT
 
 // Cycle time (milliseconds between pattern changes)
 #define cycleTime 15000
@@ -55,67 +63,79 @@
 // Time after changing settings before settings are saved to EEPROM
 #define EEPROMDELAY 2000
 
+// Frame rate limit: the LEDs are updated at most this often, and only when the
+// frame changed. show() blocks interrupts for ~2 ms, so every skipped frame is
+// time for the audio sampler.
+#define TARGETFPS 100
+
+// Frames to crossfade over when the effect changes, 0 for a hard cut
+#define CROSSFADEFRAMES 50
+
 // Include FastLED library and other useful files
 #include <Arduino.h>
 #include <FastLED.h>
 #include <EEPROM.h>
 #include <ArduinoSTL.h>
 #include <CircularBuffer.h>
-#include <AceSorting.h>
 #include <math.h>
+#include "profile.h"
 #include "XYmap.h"
+#include "polar.h"
+#include "notify.h"
+#include "output.h"
 #include "utils.h"
+#include "palettes.h"
+#include "animation.h"
+#include "trace.h"
+#include "telemetry.h"
 #include "audio.h"
+#include "settings.h"
+#include "registry.h"
 #include "effects.h"
 #include "custom_effects.h"
 #include "buttons.h"
 
-// list of functions that will be displayed
-functionList effectList[] = {
+// list of effects that will be displayed
+typedef EffectRegistry<
   // AUDIO
-  audioShadesOutline,
-  // drawVU,
+  AudioShadesOutline,
+  // DrawVU,
 
   // NO AUDIO
-  // threeSine,
-  // confetti,
-  slantBars,
-  colorFill,
+  // ThreeSine,
+  // Confetti,
+  SlantBars,
+  ColorFill,
 
   // CUSTOM
-  customAnalyzer,
-  pulseSpiral,
-  rider,
-  sideRain,
-};
+  CustomAnalyzer,
+  PulseSpiral,
+  Rider,
+  SideRain
+> Effects;
 
-const byte numEffects = (sizeof(effectList) / sizeof(effectList[0]));
+const byte numEffects = Effects::count;
+static_assert(Effects::count <= SETTINGSEFFECTS, "effectParams[] needs a byte per effect");
 
 
 // Runs one time at the start of the program (power up or reset)
 void setup() {
 
-  // check to see if EEPROM has been used yet
-  // if so, load the stored settings
-  byte eepromWasWritten = EEPROM.read(0);
-  if (eepromWasWritten == 99) {
-    currentEffect = EEPROM.read(1);
-    autoCycle = EEPROM.read(2);
-    currentBrightness = EEPROM.read(3);
-    audioEnabled = EEPROM.read(4);
-  }
+  // load the newest saved settings and learned audio state, if any
+  loadSettings();
 
   if (currentEffect > (numEffects - 1)) currentEffect = 0;
 
-  // write FastLED configuration data
-  FastLED.addLeds<CHIPSET, LED_PIN, COLOR_ORDER>(leds, LAST_VISIBLE_LED + 1);
+  // write FastLED configuration data; brightness is applied by the output stage
+  FastLED.addLeds<CHIPSET, LED_PIN, COLOR_ORDER>(overlay_leds, LAST_VISIBLE_LED + 1);
+  FastLED.setDither(0);
 
   // set global brightness value
-  FastLED.setBrightness( scale8(nextBrightness(false), MAXBRIGHTNESS) );
-  //FastLED.setDither(0);
+  setOutputBrightness(brightVals[currentBrightness]);
   // configure input buttons
   pinMode(MODEBUTTON, INPUT_PULLUP);
   pinMode(BRIGHTNESSBUTTON, INPUT_PULLUP);
+  buttonsBegin();
   pinMode(STROBEPIN, OUTPUT);
   pinMode(RESETPIN, OUTPUT);
 
@@ -126,37 +146,53 @@ void setup() {
 
   random16_add_entropy(analogRead(ANALOGPIN));
   Serial.begin(115200);
+  TRACE_HEADER(); // the restored audio state, for replays of the input trace
+
+  // start sampling the MSGEQ7 in the background
+  eqSamplerBegin();
 }
 
 // Runs over and over until power off or reset
 void loop() {
+  PROFILE_POLL();           // dump stage timings when asked over Serial
+  PROFILE_BEGIN(PROFILE_LOOP);
   currentMillis = millis(); // save the current timer value
-  updateButtons();          // read, debounce, and process the buttons
-  doButtons();              // perform actions based on button state
+  TELEMETRY_TICK();         // time the last pass, queue and send telemetry
+
+  PROFILE_BEGIN(PROFILE_BUTTONS);
+  doButtons();              // act on the button events queued by the interrupts
+  PROFILE_END(PROFILE_BUTTONS);
+
+  PROFILE_BEGIN(PROFILE_EEPROM);
   checkEEPROM();            // update the EEPROM if necessary
+  PROFILE_END(PROFILE_EEPROM);
 
-  // analyze the audio input
-  if (currentMillis - audioMillis > AUDIODELAY) {
+  // analyze the audio input whenever the sampler has a new frame
+  if (eqFrameReady) {
     audioMillis = currentMillis;
+    PROFILE_BEGIN(PROFILE_AUDIO);
     doAnalogs();
+    PROFILE_END(PROFILE_AUDIO);
+    TRACE_TICK();
   }
 
   // switch to a new effect every cycleTime milliseconds
   if (currentMillis - cycleMillis > cycleTime) {
     cycleMillis = currentMillis;
     // Pick a new palette target to fade towards
-    nextPalette = getRandomAudioPalette();
-    nextOverlayPalette = getRandomAudioPalette();
+    blendToPalettes(getRandomAudioPalette(), getRandomAudioPalette());
     if (autoCycle == true) {
       if (++currentEffect >= numEffects) currentEffect = 0; // loop to start of effect list
       effectInit = false; // trigger effect initialization when new effect is selected
     }
   }
   
-  if (currentMillis - paletteBlendMillis > 100) {
+  // blend the palettes a step toward their targets while a transition is in progress
+  if ((paletteBlending || overlayPaletteBlending) && currentMillis - paletteBlendMillis > 100) {
     paletteBlendMillis = currentMillis;
-    nblendPaletteTowardPalette(currentPalette, nextPalette, 80);
-    nblendPaletteTowardPalette(currentOverlayPalette, nextOverlayPalette, 80);
+    PROFILE_BEGIN(PROFILE_PALETTE);
+    blendPalettes();
+    PROFILE_END(PROFILE_PALETTE);
   }
 
   // increment the global hue value every hueTime milliseconds
@@ -168,13 +204,40 @@ void loop() {
   // run the currently selected effect every effectDelay milliseconds
   if (currentMillis - effectMillis > effectDelay) {
     effectMillis = currentMillis;
-    effectList[currentEffect]();
+    PROFILE_BEGIN(PROFILE_EFFECT + currentEffect);
+    if (effectInit == false) {
+      effectInit = true;
+      Effects::start(currentEffect); // fresh state for a newly selected effect
+    }
+    updatePaletteCache();
+    Effects::render(currentEffect);
+    effectDelay = Effects::interval(currentEffect);
+    PROFILE_END(PROFILE_EFFECT + currentEffect);
+    frameDirty = true;
   }
 
-  // run a fade effect
-  if (fadeActive > 0) {
-    fadeAll(fadeActive);
+  // redraw the overlay, then fade, composite, scale and show at most once per frame period
+  if (frameDue()) {
+    if (crossfading) {
+      advanceCrossfade();
+      frameDirty = true;
+    } else if (effectInit) {
+      Effects::overlay(currentEffect);
+    } else {
+      clearOverlay(); // overlay_leds holds the last frame, not the old effect's overlay
+    }
+    if (fadeActive > 0 || overlayDirty) frameDirty = true;
+    if (updateNotification(currentMillis)) frameDirty = true;
+
+    if (frameDirty) {
+      frameDirty = false;
+      PROFILE_BEGIN(PROFILE_OUTPUT);
+      renderOutput(fadeStepsAmount(fadeActive, fadeSteps()));
+      PROFILE_END(PROFILE_OUTPUT);
+      PROFILE_BEGIN(PROFILE_SHOW);
+      FastLED.show(); // send the contents of the led memory to the LEDs
+      PROFILE_END(PROFILE_SHOW);
+    }
   }
-
-  FastLED.show(); // send the contents of the led memory to the LEDs
+  PROFILE_END(PROFILE_LOOP);
 }
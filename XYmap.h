@@ -41,7 +41,6 @@ const uint8_t kMatrixHeight = 5;
 
 #define NUM_LEDS (kMatrixWidth * kMatrixHeight)
 CRGB leds[ NUM_LEDS ];
-CRGB overlay_leds[ NUM_LEDS ];
 
 
 // This function will return the right 'led index number' for 
@@ -49,6 +48,15 @@ CRGB overlay_leds[ NUM_LEDS ];
 // This code, plus the supporting 80-byte table is much smaller 
 // and much faster than trying to calculate the pixel ID with code.
 #define LAST_VISIBLE_LED 67
+CRGB overlay_leds[ LAST_VISIBLE_LED + 1 ]; // overlay layer, then the frame to show (output.h)
+constexpr uint8_t ShadesTable[NUM_LEDS] PROGMEM = {
+   68,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 69,
+   29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14,
+   30, 31, 32, 33, 34, 35, 36, 70, 71, 37, 38, 39, 40, 41, 42, 43,
+   57, 56, 55, 54, 53, 52, 51, 72, 73, 50, 49, 48, 47, 46, 45, 44,
+   74, 58, 59, 60, 61, 62, 75, 76, 77, 78, 63, 64, 65, 66, 67, 79
+};
+
 uint8_t XY( uint8_t x, uint8_t y)
 {
   // any out of bounds address maps to the first hidden pixel
@@ -56,17 +64,162 @@ uint8_t XY( uint8_t x, uint8_t y)
     return (LAST_VISIBLE_LED + 1);
   }
 
-  const uint8_t ShadesTable[] = {
-     68,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 69,
-     29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14,
-     30, 31, 32, 33, 34, 35, 36, 70, 71, 37, 38, 39, 40, 41, 42, 43,
-     57, 56, 55, 54, 53, 52, 51, 72, 73, 50, 49, 48, 47, 46, 45, 44,
-     74, 58, 59, 60, 61, 62, 75, 76, 77, 78, 63, 64, 65, 66, 67, 79
-  };
+  return pgm_read_byte(&ShadesTable[(y * kMatrixWidth) + x]);
+}
 
-  uint8_t i = (y * kMatrixWidth) + x;
-  uint8_t j = ShadesTable[i];
-  return j;
+// Row operations on the whole 16-wide grid row, holes included, so pixels
+// still take their time crossing the nose gap. Each reads the row's slice
+// of ShadesTable instead of calling XY() per pixel; y must be in range.
+
+void fillRow(uint8_t y, CRGB color) {
+  const uint8_t* row = &ShadesTable[y * kMatrixWidth];
+  for (uint8_t x = 0; x < kMatrixWidth; x++) {
+    leds[pgm_read_byte(row + x)] = color;
+  }
+}
+
+// Move every pixel in the row one column right (dir 0) or left (dir 1);
+// the column moved away from keeps its old value
+void shiftRow(uint8_t y, uint8_t dir) {
+  const uint8_t* row = &ShadesTable[y * kMatrixWidth];
+  if (dir == 0) {
+    for (uint8_t x = kMatrixWidth - 1; x > 0; x--) {
+      leds[pgm_read_byte(row + x)] = leds[pgm_read_byte(row + x - 1)];
+    }
+  } else {
+    for (uint8_t x = 0; x < kMatrixWidth - 1; x++) {
+      leds[pgm_read_byte(row + x)] = leds[pgm_read_byte(row + x + 1)];
+    }
+  }
+}
+
+// Copy the left half of the row onto the right half, mirrored
+void mirrorRow(uint8_t y) {
+  const uint8_t* row = &ShadesTable[y * kMatrixWidth];
+  for (uint8_t x = 0; x < kMatrixWidth / 2; x++) {
+    leds[pgm_read_byte(row + kMatrixWidth - 1 - x)] = leds[pgm_read_byte(row + x)];
+  }
+}
+
+// Visible pixels as physical row spans: runs of consecutive LED indices
+// along one grid row, stepping +1 or -1 per column as the strip snakes.
+// Ordered by row, then column.
+struct RowSpan {
+  uint8_t y;
+  uint8_t x;     // leftmost column
+  uint8_t first; // LED index at column x
+  uint8_t count;
+  int8_t step;   // LED index change per column to the right
+};
+
+const RowSpan VisibleSpans[] PROGMEM = {
+  {0, 1,  0, 14,  1},
+  {1, 0, 29, 16, -1},
+  {2, 0, 30,  7,  1}, {2, 9, 37, 7,  1},
+  {3, 0, 57,  7, -1}, {3, 9, 50, 7, -1},
+  {4, 1, 58,  5,  1}, {4, 10, 63, 5,  1}
+};
+#define VISIBLESPANS (sizeof(VisibleSpans) / sizeof(VisibleSpans[0]))
+
+// Walks the visible pixels only, with their coordinates, e.g.
+//   for (VisiblePixel p; p.next(); ) leds[p.index] = CHSV(p.x * 16, 255, p.y * 50);
+// or the pixels of another span table, see symmetricPixels().
+struct VisiblePixel {
+  uint8_t index;
+  uint8_t x;
+  uint8_t y;
+  const RowSpan* spans;
+  uint8_t spansLeft;
+  uint8_t remaining = 0;
+  RowSpan current;
+
+  VisiblePixel(const RowSpan* spanTable = VisibleSpans, uint8_t spanCount = VISIBLESPANS)
+    : spans(spanTable), spansLeft(spanCount) {}
+
+  boolean next() {
+    if (remaining > 0) {
+      remaining--;
+      x++;
+      index += current.step;
+      return true;
+    }
+    if (spansLeft == 0) return false;
+    spansLeft--;
+    memcpy_P(&current, spans++, sizeof(RowSpan));
+    remaining = current.count - 1;
+    x = current.x;
+    y = current.y;
+    index = current.first;
+    return true;
+  }
+};
+
+// Symmetric rendering: an effect draws only the pixels symmetricPixels()
+// walks, and mirrorPixels() copies them to the rest of the frame.
+//   SYMMETRY_MIRROR  the left lens (x < 8), copied onto the right lens
+//   SYMMETRY_QUAD    the outer half of the left lens (x < 4), copied across
+//                    the lens centre and then onto the right lens
+#define SYMMETRY_NONE 0
+#define SYMMETRY_MIRROR 1
+#define SYMMETRY_QUAD 2
+
+const RowSpan LeftLensSpans[] PROGMEM = {
+  {0, 1,  0, 7,  1},
+  {1, 0, 29, 8, -1},
+  {2, 0, 30, 7,  1},
+  {3, 0, 57, 7, -1},
+  {4, 1, 58, 5,  1}
+};
+
+// (0, 0) is a hole, but (7, 0) is its image across the lens centre
+const RowSpan QuarterSpans[] PROGMEM = {
+  {0, 0, 68, 1,  1}, {0, 1, 0, 3, 1},
+  {1, 0, 29, 4, -1},
+  {2, 0, 30, 4,  1},
+  {3, 0, 57, 4, -1},
+  {4, 1, 58, 3,  1}
+};
+
+// {source, destination} LED indices
+const uint8_t LensMirrorPairs[][2] PROGMEM = {
+  { 2,  3}, { 1,  4}, { 0,  5}, {68,  6},
+  {26, 25}, {27, 24}, {28, 23}, {29, 22},
+  {33, 34}, {32, 35}, {31, 36},
+  {54, 53}, {55, 52}, {56, 51},
+  {60, 61}, {59, 62}
+};
+
+const uint8_t LeftRightPairs[][2] PROGMEM = {
+  { 0, 13}, { 1, 12}, { 2, 11}, { 3, 10}, { 4,  9}, { 5,  8}, { 6,  7},
+  {29, 14}, {28, 15}, {27, 16}, {26, 17}, {25, 18}, {24, 19}, {23, 20}, {22, 21},
+  {30, 43}, {31, 42}, {32, 41}, {33, 40}, {34, 39}, {35, 38}, {36, 37},
+  {57, 44}, {56, 45}, {55, 46}, {54, 47}, {53, 48}, {52, 49}, {51, 50},
+  {58, 67}, {59, 66}, {60, 65}, {61, 64}, {62, 63}
+};
+
+VisiblePixel symmetricPixels(uint8_t symmetry) {
+  switch (symmetry) {
+    case SYMMETRY_MIRROR:
+      return VisiblePixel(LeftLensSpans, sizeof(LeftLensSpans) / sizeof(RowSpan));
+    case SYMMETRY_QUAD:
+      return VisiblePixel(QuarterSpans, sizeof(QuarterSpans) / sizeof(RowSpan));
+  }
+  return VisiblePixel();
+}
+
+void copyPixelPairs(const uint8_t (*pairs)[2], uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    leds[pgm_read_byte(&pairs[i][1])] = leds[pgm_read_byte(&pairs[i][0])];
+  }
+}
+
+void mirrorPixels(uint8_t symmetry) {
+  if (symmetry == SYMMETRY_QUAD) {
+    copyPixelPairs(LensMirrorPairs, sizeof(LensMirrorPairs) / 2);
+  }
+  if (symmetry != SYMMETRY_NONE) {
+    copyPixelPairs(LeftRightPairs, sizeof(LeftRightPairs) / 2);
+  }
 }
 
 const uint8_t SideTable[] = {
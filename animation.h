@@ -0,0 +1,32 @@
+// Fixed-point animation helpers
+//
+// Effects advance their animation in Q8.8: whole pixels or steps in the high
+// byte, fractions in the low byte, so no per-frame path needs float math. A
+// uint16_t position wraps after 256 whole steps, the same as a byte counter.
+// Write constants with toQ8(), which the compiler folds.
+
+constexpr uint16_t toQ8(double value) {
+  return value * 256 + 0.5;
+}
+
+// Speed in Q8.8 steps per frame driven by an audio level: the integer version
+// of constrain(level / fullScale, min, max) * gain
+uint16_t audioSpeedQ8(uint16_t level, uint16_t fullScale, uint16_t minQ8, uint16_t maxQ8, uint16_t gainQ8 = toQ8(1)) {
+  uint32_t speedQ16 = ((uint32_t)level << 16) / fullScale; // extra bits so gain doesn't magnify truncation
+  speedQ16 = constrain(speedQ16, (uint32_t)minQ8 << 8, (uint32_t)maxQ8 << 8);
+  return (speedQ16 * gainQ8) >> 16;
+}
+
+// Advance a Q8.8 phase and return the number of whole steps it crossed
+byte advancePhase(uint16_t& phaseQ8, uint16_t speedQ8) {
+  byte before = phaseQ8 >> 8;
+  phaseQ8 += speedQ8;
+  return (byte)((phaseQ8 >> 8) - before);
+}
+
+// Map level from low..high onto 0-255, clamped at both ends
+byte levelToByte(uint16_t level, uint16_t low, uint16_t high) {
+  if (level <= low) return 0;
+  if (level >= high) return 255;
+  return ((uint32_t)(level - low) * 255) / (high - low);
+}
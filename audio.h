@@ -16,22 +16,43 @@
 #define AGCSMOOTH 0.004
 #define GAINUPPERLIMIT 20.0
 #define GAINLOWERLIMIT 0.1
+#define AGCTARGET 300
+
+// Background MSGEQ7 sampling, uses the pins and AUDIODELAY above
+#include "eqsampler.h"
+
+// Fixed-point forms of the settings above, folded at compile time so doAnalogs()
+// never touches soft-float. Smoothed levels are Q8.8 (level << 8) in 32 bits,
+// which leaves headroom for GAINUPPERLIMIT * 1023 in the smoothing multiply.
+// Against the float pipeline the gain stays within 0.01 (its Q8.8 resolution) and
+// the smoothed and peak levels within 2 counts or 1.5%, whichever is larger.
+#define SPECTRUMSMOOTH_Q12 ((int32_t)(SPECTRUMSMOOTH * 4096 + 0.5))
+#define PEAKRELEASE_Q12 ((uint32_t)((1 - PEAKDECAY) * 4096 + 0.5)) // peak -= peak * (1 - PEAKDECAY)
+#define AGCSMOOTH_Q20 ((int32_t)(AGCSMOOTH * 1048576 + 0.5)) // Q20, as Q16 would put the AGC's rate 0.05% off
+#define GAINUPPERLIMIT_Q8 ((uint16_t)(GAINUPPERLIMIT * 256))
+#define GAINLOWERLIMIT_Q8 ((uint16_t)(GAINLOWERLIMIT * 256 + 0.5))
+#define ONESEVENTH_Q16 9362 // 65536 / 7
 
 // Global variables
-unsigned int spectrumValue[7];  // holds raw adc values
-float spectrumDecay[7] = {0};   // holds time-averaged values
-float spectrumPeaks[7] = {0};   // holds peak values
+unsigned int spectrumValue[7];     // holds raw adc values
+uint32_t spectrumDecayQ8[7] = {0}; // holds time-averaged values, Q8.8
+uint32_t spectrumPeaksQ8[7] = {0}; // holds peak values, Q8.8
 
-float audioAvg = 300.0;
-float gainAGC = 1.0;
+uint32_t audioAvgQ16 = (uint32_t)AGCTARGET << 16; // average band level, Q16.16
+uint16_t gainAGCQ8 = 1 << 8;                       // automatic gain, Q8.8
 
-// Beat tracking
-byte beatCounter = 0;
-uint32_t lastPredictedBeatMillis;
-uint32_t nextPredictedBeatMillis;
+// Integer views of the smoothed spectrum for effects, on the same scale as spectrumValue
+uint16_t spectrumDecayLevel(byte band) {
+  return spectrumDecayQ8[band] >> 8;
+}
 
-uint16_t millisPerBeat = 0;
-uint32_t lastConfidentBeatTimeMillis = 0;
+uint16_t spectrumPeakLevel(byte band) {
+  return spectrumPeaksQ8[band] >> 8;
+}
+
+// Beat tracking
+byte beatCounter = 0;        // counts predicted beats, advanced by the beat phase
+uint16_t millisPerBeat = 0;  // tempo estimate, 0 without confidence
 
 // Peak tracking
 uint32_t lastLocalBassPeakMillis = 0;
@@ -40,31 +61,55 @@ boolean isLocalBassPeak = false;
 
 unsigned int maxBassValue = 0;
 
-float averageOfCurrentPeaks() {
+// Onset detection: positive spectral flux per drum group and overall, each
+// against its own adaptive threshold. onsetFlags holds the ONSET_* bits for
+// the latest audio tick.
+#define ONSET_KICK 0x01  // bands 0-1
+#define ONSET_SNARE 0x02 // bands 2-4
+#define ONSET_HAT 0x04   // bands 5-6
+#define ONSET_ANY 0x08   // weighted flux over all bands
+
+#define ONSET_HISTORY 16              // ticks of flux averaged for the threshold, a power of two
+#define ONSET_THRESHOLD_Q4 24         // flux must exceed 1.5x its recent mean...
+#define ONSET_MIN_FLUX (AGCTARGET / 2) // ...plus half the AGC's target band level, so noise never triggers
+#define ONSET_HOLD_TICKS 5            // ticks before the same detector can fire again
+
+struct OnsetDetector {
+  uint16_t history[ONSET_HISTORY];
+  uint32_t historySum;
+  byte historyIndex;
+  byte holdTicks;
+};
+
+OnsetDetector onsetDetectors[4];
+unsigned int lastSpectrumValue[7] = {0};
+byte onsetFlags = 0;
+
+uint16_t averageOfCurrentPeaks() {
   unsigned int spectrumSum = 0;
   for (int i = 0; i < 7; i++) {
-    spectrumSum += spectrumPeaks[i];
+    spectrumSum += spectrumPeakLevel(i);
   }
-  return spectrumSum / 7.0;
+  return spectrumSum / 7;
 }
 
-float averageOfCurrentDecay() {
+uint16_t averageOfCurrentDecay() {
   unsigned int spectrumSum = 0;
   for (int i = 0; i < 7; i++) {
-    spectrumSum += spectrumDecay[i];
+    spectrumSum += spectrumDecayLevel(i);
   }
-  return spectrumSum / 7.0;
+  return spectrumSum / 7;
 }
 
-float averageOfCurrentValues() {
+uint16_t averageOfCurrentValues() {
   unsigned int spectrumSum = 0;
   for (int i = 0; i < 7; i++) {
     spectrumSum += spectrumValue[i];
   }
-  return spectrumSum / 7.0;
+  return spectrumSum / 7;
 }
 
-float maxOfCurrentValues() {
+uint16_t maxOfCurrentValues() {
   unsigned int maxVal = 0;
   for (int i = 0; i < 7; i++) {
     maxVal = std::max(maxVal, spectrumValue[i]);
@@ -72,7 +117,7 @@ float maxOfCurrentValues() {
   return maxVal;
 }
 
-uint16_t bpmToMillisPerBeat(uint16_t bpm) {
+constexpr uint16_t bpmToMillisPerBeat(uint16_t bpm) {
   return 1.0 / bpm * 60.0 * 1000.0;
 }
 
@@ -82,161 +127,230 @@ uint16_t millisPerBeatToBPM(uint16_t millisPerBeat) {
 
 const byte MIN_BPM = 60;
 const byte MAX_BPM = 125;
-const uint16_t MIN_MILLIS_PER_BEAT = bpmToMillisPerBeat(MAX_BPM);
-const uint16_t MAX_MILLIS_PER_BEAT = bpmToMillisPerBeat(MIN_BPM);
-
-long lastSampleAnalysis = 0;
-
-boolean hasPredictedBeat() {
-  return millisPerBeat != 0 && lastConfidentBeatTimeMillis != 0;
+constexpr uint16_t MIN_MILLIS_PER_BEAT = bpmToMillisPerBeat(MAX_BPM);
+constexpr uint16_t MAX_MILLIS_PER_BEAT = bpmToMillisPerBeat(MIN_BPM);
+
+// Streaming tempo estimate. Each kick onset adds its gap from the previous one,
+// folded into the MIN_BPM..MAX_BPM range, to a histogram of PEAK_ROUNDING ms
+// bins, and everything already there decays by 1/16. The tallest bin, refined
+// against its neighbours, gives millisPerBeat and its weight the confidence, so
+// both are current after every peak and the update costs the same every time.
+const uint8_t PEAK_ROUNDING = 15;
+const byte TEMPO_BINS = (MAX_MILLIS_PER_BEAT - MIN_MILLIS_PER_BEAT + PEAK_ROUNDING / 2) / PEAK_ROUNDING + 1;
+#define TEMPO_WEIGHT 256        // added to a gap's bin, half as much to each neighbour
+#define TEMPO_DECAY_SHIFT 4     // keep 15/16 per peak, so roughly the last 16 gaps count
+#define TEMPO_MIN_CONFIDENCE 40 // about four agreeing gaps within the window
+
+uint16_t tempoHistogram[TEMPO_BINS] = {0};
+uint8_t tempoConfidence = 0; // 0-255, 255 when the whole window agrees
+
+// Fold a gap between peaks into the expected BPM range; 0 if it's too long to mean anything
+uint16_t foldPeakGap(uint32_t gap) {
+  if (gap > 2 * MAX_MILLIS_PER_BEAT) return 0;
+  while (gap < MIN_MILLIS_PER_BEAT) gap *= 2;
+  while (gap > MAX_MILLIS_PER_BEAT) gap /= 2;
+  return gap;
 }
 
-uint32_t getLastPredictedBeatMillis() {
-  // Int division will round down to the number of beats we've passed without confidence
-  uint16_t beatsFromPredictionToLast = (currentMillis - lastConfidentBeatTimeMillis) / millisPerBeat;
-  // Scale back up to get the actual time of the last beat
-  return beatsFromPredictionToLast * millisPerBeat + lastConfidentBeatTimeMillis;
+void addTempoWeight(int8_t bin, uint16_t weight) {
+  if (bin >= 0 && bin < TEMPO_BINS) tempoHistogram[bin] += weight;
 }
 
-uint32_t getNextPredictedBeatMillis() {
-  // Int division will round down to the number of beats we've passed without confidence
-  uint16_t beatsFromPredictionToLast = (currentMillis - lastConfidentBeatTimeMillis) / millisPerBeat;
-  // Scale back up to get the actual time of the last beat
-  return (beatsFromPredictionToLast + 1) * millisPerBeat + lastConfidentBeatTimeMillis;
-}
+// Update millisPerBeat and tempoConfidence for a kick onset at peakMillis
+void updateTempo(uint32_t previousPeakMillis, uint32_t peakMillis) {
+  uint16_t gap = foldPeakGap(peakMillis - previousPeakMillis);
+  if (gap == 0) return;
 
-const uint8_t PEAK_ROUNDING = 15;
-void fixupPeakGaps(unsigned int* peakGaps, byte size) {
-  // Adjust gaps to fit into expected BPM range
-  for (int i = 0; i < size; i++) {
-    while (!(MIN_MILLIS_PER_BEAT <= peakGaps[i] && peakGaps[i] <= MAX_MILLIS_PER_BEAT)) {
-      if (peakGaps[i] < MIN_MILLIS_PER_BEAT) {
-        peakGaps[i] *= 2;
-      } else {
-        peakGaps[i] /= 2.0;
-      }
-    }
+  for (byte i = 0; i < TEMPO_BINS; i++) {
+    tempoHistogram[i] -= tempoHistogram[i] >> TEMPO_DECAY_SHIFT;
+  }
+  int8_t gapBin = (gap - MIN_MILLIS_PER_BEAT + PEAK_ROUNDING / 2) / PEAK_ROUNDING;
+  addTempoWeight(gapBin, TEMPO_WEIGHT);
+  addTempoWeight(gapBin - 1, TEMPO_WEIGHT / 2);
+  addTempoWeight(gapBin + 1, TEMPO_WEIGHT / 2);
+
+  byte best = 0;
+  for (byte i = 1; i < TEMPO_BINS; i++) {
+    if (tempoHistogram[i] > tempoHistogram[best]) best = i;
+  }
 
-    // For purpose of bucketing into histogram, floor to nearest 15
-    peakGaps[i] = (peakGaps[i] + PEAK_ROUNDING / 2) / PEAK_ROUNDING * PEAK_ROUNDING;
+  // A full window of identical gaps converges on TEMPO_WEIGHT << TEMPO_DECAY_SHIFT
+  tempoConfidence = std::min<uint16_t>(tempoHistogram[best] >> TEMPO_DECAY_SHIFT, 255);
+  if (tempoConfidence < TEMPO_MIN_CONFIDENCE) {
+    // No confidence in BPM
+    millisPerBeat = 0;
+    return;
   }
+
+  // Parabolic interpolation between the tallest bin and its neighbours
+  int32_t left = best > 0 ? tempoHistogram[best - 1] : 0;
+  int32_t centre = tempoHistogram[best];
+  int32_t right = best < TEMPO_BINS - 1 ? tempoHistogram[best + 1] : 0;
+  int32_t curvature = 2 * centre - left - right;
+  int16_t offset = curvature > 0 ? (right - left) * PEAK_ROUNDING / (2 * curvature) : 0;
+  millisPerBeat = MIN_MILLIS_PER_BEAT + best * PEAK_ROUNDING + offset;
 }
 
-// Get the most common gap in the histogram or 0 if we don't have confidence
-uint16_t getMostCommonGap(unsigned int * peakGaps, byte size) {
-  ace_sorting::shellSortKnuth(peakGaps, size);
-  Serial.print("Sorted adjusted gaps histo: ");
-  printArray(peakGaps, size);
-
-  int mostCommonItem;
-  int countOfMostCommonItem = 0;
-  int countOfCurrentItem = 0;
-  int lastValue = 0;
-  for (int i = 0; i < size; i++) {
-    if (lastValue == peakGaps[i]) {
-      countOfCurrentItem++;
-    } else {
-      countOfCurrentItem = 1;
-    }
+// Start from a remembered tempo, as a histogram peak at millisPerBeat. Its
+// weight is capped at twice TEMPO_MIN_CONFIDENCE so that, if the music has
+// changed, a few kicks at the new tempo outweigh it.
+void seedTempo(uint16_t rememberedMillisPerBeat, uint8_t confidence) {
+  if (rememberedMillisPerBeat < MIN_MILLIS_PER_BEAT || rememberedMillisPerBeat > MAX_MILLIS_PER_BEAT) return;
+  if (confidence < TEMPO_MIN_CONFIDENCE) return;
+  confidence = std::min(confidence, (uint8_t)(2 * TEMPO_MIN_CONFIDENCE));
+
+  uint16_t weight = (uint16_t)confidence << TEMPO_DECAY_SHIFT;
+  int8_t bin = (rememberedMillisPerBeat - MIN_MILLIS_PER_BEAT + PEAK_ROUNDING / 2) / PEAK_ROUNDING;
+  addTempoWeight(bin, weight);
+  addTempoWeight(bin - 1, weight / 2);
+  addTempoWeight(bin + 1, weight / 2);
+  tempoConfidence = confidence;
+  millisPerBeat = rememberedMillisPerBeat;
+}
 
-    if (countOfCurrentItem > countOfMostCommonItem) {
-      countOfMostCommonItem = countOfCurrentItem;
-      mostCommonItem = peakGaps[i];
-    }
+// Beat phase-locked loop. The phase free-runs at the locked period between
+// peaks; each kick onset within a quarter beat of a predicted beat pulls phase
+// and period toward it by a bounded step, so predictions glide instead of
+// jumping. Peaks further off the grid (offbeats, fills) are ignored. When
+// there is no tempo, or the tempo estimate moves away from the locked period,
+// the loop re-acquires on the next peak.
+#define BEAT_PHASE_ONE (1UL << 24)              // phase units per beat
+#define BEAT_CAPTURE_RANGE (BEAT_PHASE_ONE / 4) // largest phase error that steers the loop
+#define BEAT_PHASE_GAIN_SHIFT 2                 // correct 1/4 of the phase error per peak
+#define BEAT_MAX_PHASE_STEP (BEAT_PHASE_ONE / 16)
+#define BEAT_PERIOD_GAIN_SHIFT 4                // and 1/16 of it in period
+#define BEAT_MAX_PERIOD_STEP_Q8 (4 << 8)        // at most 4 ms per peak
+#define BEAT_RELOCK_MILLIS (2 * PEAK_ROUNDING)  // tempo change that forces re-acquisition
+#define BEAT_LATENCY_MILLIS (AUDIODELAY + 1)    // a kick is detected in the sampler frame after it starts
+
+uint32_t beatPhaseQ24 = 0;       // position within the beat, BEAT_PHASE_ONE per beat
+uint32_t beatPhaseIncrement = 0; // phase units per millisecond, 0 while unlocked
+uint32_t beatPeriodQ8 = 0;       // locked beat period in ms, Q24.8
+uint32_t beatPhaseMillis = 0;    // time the phase was last advanced to
 
-    lastValue = peakGaps[i];
-  }
+boolean hasPredictedBeat() {
+  return beatPhaseIncrement != 0;
+}
 
-  if (countOfMostCommonItem < 4) {
-    Serial.println("No confidence in BPM");
-    return 0;
-  }
+void setBeatPeriod(uint32_t periodQ8) {
+  beatPeriodQ8 = periodQ8;
+  beatPhaseIncrement = 0xFFFFFFFFUL / periodQ8; // BEAT_PHASE_ONE / period in ms
+}
 
-  Serial.print("Most common millis gap: ");
-  Serial.println(mostCommonItem);
-  // Serial.println(countOfMostCommonItem);
+// Move the phase forward to currentMillis, counting the beats that passed
+void advanceBeatPhase() {
+  uint32_t elapsed = std::min(currentMillis - beatPhaseMillis, (uint32_t)MAX_MILLIS_PER_BEAT);
+  beatPhaseMillis = currentMillis;
+  if (!hasPredictedBeat()) return;
 
-  return mostCommonItem;
+  beatPhaseQ24 += elapsed * beatPhaseIncrement;
+  beatCounter += beatPhaseQ24 >> 24;
+  beatPhaseQ24 &= BEAT_PHASE_ONE - 1;
 }
 
-void analyzeSamples() {
-  Serial.println("ANALYZING SAMPLES");
+// Position within the current beat, 0-255; cheap enough for every frame
+byte beatPhase() {
+  advanceBeatPhase();
+  return beatPhaseQ24 >> 16;
+}
 
-  printSampleTimes();
-  if (rollingPeaks.size() < 8) {
+// Steer the loop with a kick onset detected now
+void steerBeatPhase() {
+  advanceBeatPhase();
+  if (millisPerBeat == 0) {
+    beatPhaseIncrement = 0;
     return;
   }
-  byte peakGapsSize = rollingPeaks.size() - 1;
-  unsigned int peakGaps[peakGapsSize];
-  for (int i = 0; i < peakGapsSize; i++) {
-    peakGaps[i] = rollingPeaks[i + 1] - rollingPeaks[i];
+
+  uint16_t lockedMillis = beatPeriodQ8 >> 8;
+  if (!hasPredictedBeat() || abs((int16_t)lockedMillis - (int16_t)millisPerBeat) > BEAT_RELOCK_MILLIS) {
+    // Acquire: take the estimated tempo and put a beat on this peak
+    setBeatPeriod((uint32_t)millisPerBeat << 8);
+    beatPhaseQ24 = BEAT_LATENCY_MILLIS * beatPhaseIncrement;
+    return;
   }
-  Serial.print("Gaps: ");
-  printArray(peakGaps, peakGapsSize);
-  
-  fixupPeakGaps(peakGaps, peakGapsSize);
 
-  Serial.print("Adjusted gaps: ");
-  printArray(peakGaps, peakGapsSize);
+  // Phase the peak actually happened at, as a signed error around the beat;
+  // positive means the predicted beat came early
+  uint32_t onsetPhase = (beatPhaseQ24 - BEAT_LATENCY_MILLIS * beatPhaseIncrement) & (BEAT_PHASE_ONE - 1);
+  int32_t error = onsetPhase < BEAT_PHASE_ONE / 2 ? (int32_t)onsetPhase : (int32_t)onsetPhase - (int32_t)BEAT_PHASE_ONE;
+  if (abs(error) > (int32_t)BEAT_CAPTURE_RANGE) return;
+
+  int32_t phaseStep = constrain(error >> BEAT_PHASE_GAIN_SHIFT, -(int32_t)BEAT_MAX_PHASE_STEP, (int32_t)BEAT_MAX_PHASE_STEP);
+  int32_t phase = (int32_t)beatPhaseQ24 - phaseStep;
+  if (phase < 0) {
+    // pulled back across the beat we just counted
+    phase += BEAT_PHASE_ONE;
+    beatCounter--;
+  } else if (phase >= (int32_t)BEAT_PHASE_ONE) {
+    phase -= BEAT_PHASE_ONE;
+    beatCounter++;
+  }
+  beatPhaseQ24 = phase;
 
-  // Update global beat tracking with either the high confident beat gap or
-  // 0 to indicate we don't have confidence
-  millisPerBeat = getMostCommonGap(peakGaps, peakGapsSize);
+  // error in ms, Q8: error / BEAT_PHASE_ONE * period, kept within 32 bits
+  int32_t errorQ8 = ((error >> 8) * (int32_t)(beatPeriodQ8 >> 4)) >> 12;
+  int32_t periodStep = constrain(errorQ8 >> BEAT_PERIOD_GAIN_SHIFT, -BEAT_MAX_PERIOD_STEP_Q8, BEAT_MAX_PERIOD_STEP_Q8);
+  setBeatPeriod(beatPeriodQ8 + periodStep);
+}
 
-  if (millisPerBeat == 0) {
-    // No confidence in BPM
-    return;
-  }
+// Feed one tick of flux to a detector; true if it marks an onset
+boolean detectOnset(OnsetDetector& detector, uint32_t flux) {
+  uint16_t clampedFlux = std::min(flux, (uint32_t)0xFFFF);
+  uint32_t threshold = ((detector.historySum / ONSET_HISTORY) * ONSET_THRESHOLD_Q4 >> 4) + ONSET_MIN_FLUX;
+  boolean onset = detector.holdTicks == 0 && clampedFlux > threshold;
 
-  Serial.print("BPM: ");
-  Serial.println(millisPerBeatToBPM(millisPerBeat));
-
-  // Find the latest peak gap that matches the beat we calculated and set it, if any
-  // (possibly is from a past analysis but still in the histo)
-  for (int i = 0; i < peakGapsSize; i++) {
-    if (peakGaps[i] == millisPerBeat) {
-      lastConfidentBeatTimeMillis = rollingPeaks[i + 1];
-      // Attempt to stop jumping of beat visuals
-      // if (getNextPredictedBeatMillis() - lastPredictedBeatMillis < 100) {
-      //   beatCounter--;
-      // }
-      Serial.print("Found confident beat time: ");
-      Serial.println(lastConfidentBeatTimeMillis);
-    }
+  if (onset) {
+    detector.holdTicks = ONSET_HOLD_TICKS;
+  } else if (detector.holdTicks > 0) {
+    detector.holdTicks--;
   }
+
+  detector.historySum += clampedFlux - detector.history[detector.historyIndex];
+  detector.history[detector.historyIndex] = clampedFlux;
+  detector.historyIndex = (detector.historyIndex + 1) % ONSET_HISTORY;
+  return onset;
 }
 
-void updateBeats() {
-  if (hasPredictedBeat() && nextPredictedBeatMillis < currentMillis) {
-    lastPredictedBeatMillis = nextPredictedBeatMillis;
-    nextPredictedBeatMillis = getNextPredictedBeatMillis();
-    beatCounter++;
+// Positive spectral flux of the gained spectrum since the last tick
+void updateOnsets() {
+  static PROGMEM const byte fluxWeights[7] = {4, 4, 2, 2, 2, 1, 1};
+  uint32_t groupFlux[3] = {0, 0, 0};
+  uint32_t weightedFlux = 0;
+
+  for (byte i = 0; i < 7; i++) {
+    uint16_t rise = spectrumValue[i] > lastSpectrumValue[i] ? spectrumValue[i] - lastSpectrumValue[i] : 0;
+    groupFlux[i < 2 ? 0 : i < 5 ? 1 : 2] += rise;
+    weightedFlux += rise * pgm_read_byte(fluxWeights + i);
+    lastSpectrumValue[i] = spectrumValue[i];
   }
+
+  onsetFlags = 0;
+  if (detectOnset(onsetDetectors[0], groupFlux[0])) onsetFlags |= ONSET_KICK;
+  if (detectOnset(onsetDetectors[1], groupFlux[1])) onsetFlags |= ONSET_SNARE;
+  if (detectOnset(onsetDetectors[2], groupFlux[2])) onsetFlags |= ONSET_HAT;
+  if (detectOnset(onsetDetectors[3], weightedFlux >> 2)) onsetFlags |= ONSET_ANY;
+}
+
+// Calculate gain adjustment factor, AGCTARGET / audioAvg in Q8.8
+void updateGainAGC() {
+  uint32_t audioAvgQ8 = audioAvgQ16 >> 8;
+  uint32_t gain = audioAvgQ8 ? (((uint32_t)AGCTARGET << 16) + audioAvgQ8 / 2) / audioAvgQ8 : GAINUPPERLIMIT_Q8;
+  gainAGCQ8 = constrain(gain, GAINLOWERLIMIT_Q8, GAINUPPERLIMIT_Q8);
 }
 
 void doAnalogs() {
   static PROGMEM const byte spectrumFactors[7] = {8, 8, 9, 8, 7, 3, 10};
 
-  // reset MSGEQ7 to first frequency bin
-  digitalWrite(RESETPIN, HIGH);
-  delayMicroseconds(5);
-  digitalWrite(RESETPIN, LOW);
-  delayMicroseconds(10);
+  // pick up the frame the interrupt-driven sampler finished (see eqsampler.h)
+  eqTakeFrame(spectrumValue);
 
   // store sum of values for AGC
   unsigned int analogsum = 0;
 
-  // cycle through each MSGEQ7 bin and read the analog values
+  // process each MSGEQ7 bin
   for (int i = 0; i < 7; i++) {
-
-    // set up the MSGEQ7
-    digitalWrite(STROBEPIN, LOW);
-    delayMicroseconds(25); // allow the output to settle
-
-    // read the analog value
-    spectrumValue[i] = (analogRead(ANALOGPIN)+analogRead(ANALOGPIN)+analogRead(ANALOGPIN))/3;
-    digitalWrite(STROBEPIN, HIGH);
-    delayMicroseconds(30);
+    TRACE_SAMPLE(i, spectrumValue[i]);
 
     // noise floor filter
     if (spectrumValue[i] < NOISEFLOOR) {
@@ -252,43 +366,49 @@ void doAnalogs() {
     analogsum += spectrumValue[i];
 
     // apply current gain value
-    spectrumValue[i] *= gainAGC;
+    spectrumValue[i] = ((uint32_t)spectrumValue[i] * gainAGCQ8) >> 8;
 
-    // process time-averaged values
-    spectrumDecay[i] = (1.0 - SPECTRUMSMOOTH) * spectrumDecay[i] + SPECTRUMSMOOTH * spectrumValue[i];
+    // process time-averaged values: decay += (value - decay) * SPECTRUMSMOOTH
+    int32_t decayError = ((int32_t)spectrumValue[i] << 8) - (int32_t)spectrumDecayQ8[i];
+    spectrumDecayQ8[i] += (decayError * SPECTRUMSMOOTH_Q12) >> 12;
 
     // process peak values
-    spectrumPeaks[i] = std::max(spectrumPeaks[i] * PEAKDECAY, spectrumDecay[i]);
+    spectrumPeaksQ8[i] -= (spectrumPeaksQ8[i] * PEAKRELEASE_Q12) >> 12;
+    spectrumPeaksQ8[i] = std::max(spectrumPeaksQ8[i], spectrumDecayQ8[i]);
   }
 
-  if (lastBassValue > spectrumValue[1] && spectrumValue[1] > spectrumPeaks[1] * 1.50f && currentMillis > lastLocalBassPeakMillis + MIN_MILLIS_PER_BEAT / 4) {
+  updateOnsets();
+
+  // value > 1.5 * peak, compared in Q8.8
+  boolean aboveBassPeak = ((uint32_t)spectrumValue[1] << 9) > spectrumPeaksQ8[1] * 3;
+  if (lastBassValue > spectrumValue[1] && aboveBassPeak && currentMillis > lastLocalBassPeakMillis + MIN_MILLIS_PER_BEAT / 4) {
     isLocalBassPeak = true;
     lastLocalBassPeakMillis = currentMillis;
-    // Record the time of any peaks for BPM calculations
-    rollingPeaks.push(currentMillis);
   } else {
     isLocalBassPeak = false;
   }
   lastBassValue = spectrumValue[1];
 
+  // Kick onsets drive the tempo estimate and the beat phase
+  if (onsetFlags & ONSET_KICK) {
+    if (peakCount > 0) updateTempo(newestPeakMillis, currentMillis);
+    pushPeak(currentMillis);
+    steerBeatPhase();
+  }
+
   // if (spectrumValue[1] > maxBassValue) {
   //   maxBassValue = spectrumValue[1];
   //   Serial.print("New max bass: ");
   //   Serial.println(maxBassValue);
   // }
 
-  // Calculate audio levels for automatic gain
-  audioAvg = (1.0 - AGCSMOOTH) * audioAvg + AGCSMOOTH * (analogsum / 7.0);
-
-  // Calculate gain adjustment factor
-  gainAGC = constrain(300.0 / audioAvg, GAINLOWERLIMIT, GAINUPPERLIMIT);
-  // Serial.println(gainAGC);
+  // Calculate audio levels for automatic gain: avg += (sum / 7 - avg) * AGCSMOOTH
+  int32_t avgError = (int32_t)(analogsum * (uint32_t)ONESEVENTH_Q16) - (int32_t)audioAvgQ16;
+  audioAvgQ16 += ((avgError >> 8) * AGCSMOOTH_Q20) >> 12;
 
-  // Analyze samples to determine BPM every ~3 seconds
-  if (currentMillis - lastSampleAnalysis > 2500) {
-    lastSampleAnalysis = currentMillis;
-    analyzeSamples();
-  }
+  updateGainAGC();
+  // Serial.println(gainAGCQ8 / 256.0);
 
-  updateBeats();
+  advanceBeatPhase();
+  TELEMETRY_AUDIO();
 }
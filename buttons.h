@@ -1,4 +1,12 @@
 // Process button inputs and return button activity
+//
+// Buttons are sampled from interrupts, not from loop(): a pin change on
+// either button starts a debounce tick of about 1 ms (Timer0's compare B, so
+// millis() is undisturbed), which reads both buttons with a single PIND read,
+// debounces them and stops again once both are released and idle. Finished
+// gestures are pushed as events onto a single-producer/single-consumer queue
+// that doButtons() drains. On the host the same tick runs from simulated
+// interrupts (see host/sim.cpp), which provide the platform functions below.
 
 #define NUMBUTTONS 2
 #define MODEBUTTON 4
@@ -7,97 +15,176 @@
 #define BTNIDLE 0
 #define BTNDEBOUNCING 1
 #define BTNPRESSED 2
-#define BTNRELEASED 3
-#define BTNLONGPRESS 4
-#define BTNLONGPRESSREAD 5
-#define BTNGUARDTIME 6
+#define BTNLONGPRESSED 3
+#define BTNGUARDTIME 4
 
 #define BTNDEBOUNCETIME 30
 #define BTNLONGPRESSTIME 1500
 
+// Events: the type in the high nibble, the button in the low one
+#define BTNEVENTPRESS 0x10     // pressed and released quickly
+#define BTNEVENTLONGPRESS 0x20 // held down for BTNLONGPRESSTIME
+#define BTNEVENTCHORD 0x30     // both buttons pressed together
+#define BTNEVENT(type, button) ((type) | (button))
+
+#define BTNQUEUESIZE 8 // a power of two
+
+// Button 0 is on BRIGHTNESSBUTTON and button 1 on MODEBUTTON
+const byte buttonmap[NUMBUTTONS] = {BRIGHTNESSBUTTON, MODEBUTTON};
+extern const byte numEffects;
+
+// Debounce state, only touched by the tick
 uint32_t buttonEvents[NUMBUTTONS];
 byte buttonStatuses[NUMBUTTONS];
-byte buttonmap[NUMBUTTONS] = {BRIGHTNESSBUTTON, MODEBUTTON};
-extern const byte numEffects;
 
+volatile uint8_t buttonQueue[BTNQUEUESIZE];
+volatile uint8_t buttonQueueHead = 0; // written only by the interrupts
+volatile uint8_t buttonQueueTail = 0; // written only by loop()
+volatile uint8_t buttonQueueDropped = 0; // events lost to a full queue
+
+// Platform layer: sample both buttons (bit n set when button n is down) and
+// start or stop the debounce tick
+uint8_t buttonReadPins();
+void buttonTickEnable(boolean enable);
+
+void pushButtonEvent(uint8_t event) {
+  uint8_t next = (buttonQueueHead + 1) & (BTNQUEUESIZE - 1);
+  if (next == buttonQueueTail) {
+    buttonQueueDropped++;
+    return;
+  }
+  buttonQueue[buttonQueueHead] = event;
+  buttonQueueHead = next; // publish after the event is in place
+}
+
+// Take the oldest event; returns false if there is none
+boolean popButtonEvent(uint8_t& event) {
+  uint8_t tail = buttonQueueTail;
+  if (tail == buttonQueueHead) return false;
+  event = buttonQueue[tail];
+  buttonQueueTail = (tail + 1) & (BTNQUEUESIZE - 1);
+  return true;
+}
+
+// Pin change: make sure the tick is running
+void buttonPinChange() {
+  buttonTickEnable(true);
+}
+
+// Tick: debounce both buttons and turn finished gestures into events
+void buttonTick() {
+  uint8_t pressed = buttonReadPins();
+  uint32_t now = millis();
+  boolean busy = pressed != 0;
 
-void updateButtons() {
   for (byte i = 0; i < NUMBUTTONS; i++) {
+    boolean down = pressed & (1 << i);
     switch (buttonStatuses[i]) {
       case BTNIDLE:
-        if (digitalRead(buttonmap[i]) == LOW) {
-          buttonEvents[i] = currentMillis;
+        if (down) {
+          buttonEvents[i] = now;
           buttonStatuses[i] = BTNDEBOUNCING;
         }
         break;
 
       case BTNDEBOUNCING:
-        if (currentMillis - buttonEvents[i] > BTNDEBOUNCETIME) {
-          if (digitalRead(buttonmap[i]) == LOW) {
-            buttonStatuses[i] = BTNPRESSED;
-          }
+        if (!down) {
+          buttonStatuses[i] = BTNIDLE; // a bounce
+        } else if (now - buttonEvents[i] > BTNDEBOUNCETIME) {
+          buttonStatuses[i] = BTNPRESSED;
         }
         break;
 
       case BTNPRESSED:
-        if (digitalRead(buttonmap[i]) == HIGH) {
-          buttonStatuses[i] = BTNRELEASED;
-        } else if (currentMillis - buttonEvents[i] > BTNLONGPRESSTIME) {
-          buttonStatuses[i] = BTNLONGPRESS;
+        if (!down) {
+          pushButtonEvent(BTNEVENT(BTNEVENTPRESS, i));
+          buttonStatuses[i] = BTNIDLE;
+        } else if (now - buttonEvents[i] > BTNLONGPRESSTIME) {
+          pushButtonEvent(BTNEVENT(BTNEVENTLONGPRESS, i));
+          buttonStatuses[i] = BTNLONGPRESSED;
         }
         break;
 
-      case BTNRELEASED:
-        break;
-
-      case BTNLONGPRESS:
+      case BTNLONGPRESSED:
+        if (!down) buttonStatuses[i] = BTNIDLE;
         break;
 
-      case BTNLONGPRESSREAD:
-        if (digitalRead(buttonmap[i]) == HIGH) {
-          buttonStatuses[i] = BTNIDLE;
-        }
+      case BTNGUARDTIME: // after a chord, until both are released
+        if (!pressed) buttonStatuses[i] = BTNIDLE;
         break;
-
-      case BTNGUARDTIME:
-        if (digitalRead(buttonmap[0]) == HIGH && digitalRead(buttonmap[1]) == HIGH) {
-          buttonStatuses[i] = BTNIDLE;
-        }
     }
+    if (buttonStatuses[i] != BTNIDLE) busy = true;
+  }
+
+  if (buttonStatuses[0] == BTNPRESSED && buttonStatuses[1] == BTNPRESSED) {
+    pushButtonEvent(BTNEVENTCHORD);
+    buttonStatuses[0] = BTNGUARDTIME;
+    buttonStatuses[1] = BTNGUARDTIME;
   }
+
+  if (!busy) buttonTickEnable(false);
 }
 
-byte buttonStatus(byte buttonNum) {
+#ifdef __AVR__
+
+// Arduino pins 0-7 are PD0-PD7, which are also PCINT16-23
+uint8_t buttonReadPins() {
+  uint8_t pins = ~PIND;
+  return ((pins >> BRIGHTNESSBUTTON) & 1) | (((pins >> MODEBUTTON) & 1) << 1);
+}
 
-  byte tempStatus = buttonStatuses[buttonNum];
-  if (tempStatus == BTNRELEASED) {
-    buttonStatuses[buttonNum] = BTNIDLE;
-  } else if (tempStatus == BTNLONGPRESS) {
-    buttonStatuses[buttonNum] = BTNLONGPRESSREAD;
+// Only called from the interrupts, so TIMSK0 needs no further protection
+void buttonTickEnable(boolean enable) {
+  if (enable) {
+    TIFR0 = _BV(OCF0B);
+    TIMSK0 |= _BV(OCIE0B);
+  } else {
+    TIMSK0 &= ~_BV(OCIE0B);
   }
+}
 
-  return tempStatus;
+ISR(PCINT2_vect) {
+  buttonPinChange();
+}
 
+ISR(TIMER0_COMPB_vect) {
+  buttonTick();
 }
 
-void doButtons() {
+// Start watching the buttons; the pins must already be inputs with pull-ups
+void buttonsBegin() {
+  OCR0B = 128; // half way between Timer0 overflows, which keep millis()
+  PCMSK2 |= _BV(BRIGHTNESSBUTTON) | _BV(MODEBUTTON);
+  PCIFR = _BV(PCIF2);
+  PCICR |= _BV(PCIE2);
+  noInterrupts();
+  buttonTickEnable(true); // in case a button is already down
+  interrupts();
+}
 
-  if ((buttonStatuses[0] == BTNPRESSED) && (buttonStatuses[1] == BTNPRESSED)) {
-    audioEnabled = !audioEnabled; // toggle audio mode TODO remove / change button
+#else
 
-    currentEffect = 0;
-    effectInit = false;
-    eepromMillis = currentMillis;
-    eepromOutdated = true;
-    confirmBlink(CRGB::DarkGreen, 3);
-    buttonStatuses[0] = BTNGUARDTIME;
-    buttonStatuses[1] = BTNGUARDTIME;
-  } else {
+void buttonsBegin();
 
-    // Check the mode button (for switching between effects)
-    switch (buttonStatus(0)) {
+#endif
 
-      case BTNRELEASED: // button was pressed and released quickly
+void doButtons() {
+  uint8_t event;
+  while (popButtonEvent(event)) {
+    switch (event) {
+
+      case BTNEVENTCHORD: // both buttons at once
+        audioEnabled = !audioEnabled; // toggle audio mode TODO remove / change button
+
+        currentEffect = 0;
+        effectInit = false;
+        eepromMillis = currentMillis;
+        eepromOutdated = true;
+        notify(CRGB::DarkGreen, 3, NOTIFY_AUDIO);
+        break;
+
+      // Button 0 switches between effects
+      case BTNEVENT(BTNEVENTPRESS, 0):
         cycleMillis = currentMillis;
         if (++currentEffect >= numEffects) currentEffect = 0; // loop to start of effect list
         effectInit = false; // trigger effect initialization when new effect is selected
@@ -105,38 +192,32 @@ void doButtons() {
         eepromOutdated = true;
         break;
 
-      case BTNLONGPRESS: // button was held down for a while
+      case BTNEVENT(BTNEVENTLONGPRESS, 0):
         autoCycle = !autoCycle; // toggle auto cycle mode
         // one blue blink: auto mode. two red blinks: manual mode.
         if (autoCycle) {
-          confirmBlink(CRGB::Blue, 1);
+          notify(CRGB::Blue, 1, NOTIFY_AUTOCYCLE);
         } else {
-          confirmBlink(CRGB::Red, 2);
+          notify(CRGB::Red, 2, NOTIFY_AUTOCYCLE);
         }
         eepromMillis = currentMillis;
         eepromOutdated = true;
         break;
 
-    }
-
-    // Check the brightness adjust button
-    switch (buttonStatus(1)) {
-
-      case BTNRELEASED: // button was pressed and released quickly
-        FastLED.setBrightness(scale8(nextBrightness(false), MAXBRIGHTNESS));
+      // Button 1 adjusts the brightness
+      case BTNEVENT(BTNEVENTPRESS, 1):
+        setOutputBrightness(nextBrightness(false));
         eepromMillis = currentMillis;
         eepromOutdated = true;
         break;
 
-      case BTNLONGPRESS: // button was held down for a while
+      case BTNEVENT(BTNEVENTLONGPRESS, 1):
         // reset brightness to startup value
-        FastLED.setBrightness(scale8(nextBrightness(true), MAXBRIGHTNESS));
+        setOutputBrightness(nextBrightness(true));
         eepromMillis = currentMillis;
         eepromOutdated = true;
         break;
 
     }
-
   }
-
 }
@@ -1,206 +1,243 @@
 //   Graphical effects to run on the RGB Shades LED array
-//   Each function should have the following components:
-//    * Must be declared void with no parameters or will break function pointer array
-//    * Check effectInit, if false then init any required settings and set effectInit true
-//    * Set effectDelay (the time in milliseconds until the next run of this effect)
-//    * All animation should be controlled with counters and effectDelay, no delay() or loops
+//   Each effect is a struct following the interface in registry.h:
+//    * Keep animation counters in State, not in statics; it is zeroed when the effect is selected
+//    * init() sets up any required settings (fadeActive, palettes)
+//    * interval() returns the time in milliseconds until the next render
+//    * All animation should be controlled with counters and interval(), no delay() or loops
 //    * Pixel data should be written using leds[XY(x,y)] to map coordinates to the RGB Shades layout
 
 void overlaySideBeat() {
   if (isLocalBassPeak) {
-    for (int i = 0; i < SIDESIZE; i++) {
-      leds[SideTable[i]] = ColorFromPalette(currentOverlayPalette, 150);
+    for (byte i = 0; i < SIDESIZE; i++) {
+      setOverlayPixel(SideTable[i], ColorFromPalette(currentOverlayPalette, 150));
     }
   }
 }
 
 void overlayTopLineBeatPrediction() {
   if (hasPredictedBeat()) {
-    // Serial.print("Predictions: ");
-    // Serial.print(lastPredictedBeatMillis);
-    // Serial.print(' ');
-    // Serial.print(currentMillis);
-    // Serial.print(' ');
-    // Serial.println(nextPredictedBeatMillis);
+    byte phase = beatPhase(); // also brings beatCounter up to date
     boolean travelRight = beatCounter % 2 == 0;
-    byte easedTimeBetweenBeats = ease8InOutQuad(mapToByteRange(currentMillis, lastPredictedBeatMillis, nextPredictedBeatMillis));
+    byte easedTimeBetweenBeats = ease8InOutQuad(phase);
     byte activeLED = travelRight ?
       mapFromByteRange(easedTimeBetweenBeats, 0, 13) :
       mapFromByteRange(easedTimeBetweenBeats, 13, 0);
-    leds[activeLED] = ColorFromPalette(currentOverlayPalette, 150, 150);
+    setOverlayPixel(activeLED, ColorFromPalette(currentOverlayPalette, 150, 150));
   }
 }
 
+// Bass envelope for the current frame: bassEnvelope[k] is the time from the
+// last kick at or before k * 8 ms ago to that instant, 0xFFFF if none. It is
+// rebuilt once per frame (or new kick) in a single sweep back through the peak
+// history, so per-pixel lookups are a table read.
+#define BASS_ENVELOPE_STEP_SHIFT 3 // 8 ms per entry
+#define BASS_ENVELOPE_SIZE 64      // covers the last 512 ms
+uint16_t bassEnvelope[BASS_ENVELOPE_SIZE];
+uint32_t bassEnvelopeMillis = 0;
+uint32_t bassEnvelopePeak = 0;
+byte bassEnvelopePeaks = 0;
+
+void updateBassEnvelope() {
+  if (bassEnvelopeMillis == currentMillis && bassEnvelopePeak == newestPeakMillis && bassEnvelopePeaks == peakCount) return;
+  bassEnvelopeMillis = currentMillis;
+  bassEnvelopePeak = newestPeakMillis;
+  bassEnvelopePeaks = peakCount;
+
+  // cursor walks back through the peaks as the instants get older
+  uint32_t peak = newestPeakMillis;
+  byte peakIndex = 0;
+  for (byte k = 0; k < BASS_ENVELOPE_SIZE; k++) {
+    uint32_t millisAgo = (uint32_t)k << BASS_ENVELOPE_STEP_SHIFT;
+    uint32_t target = currentMillis - millisAgo;
+    while ((int32_t)(target - peak) < 0 && peakIndex + 1 < peakCount) {
+      peak -= peakGapBefore(peakIndex++);
+    }
+    boolean found = peakCount > 0 && millisAgo <= currentMillis && (int32_t)(target - peak) >= 0;
+    bassEnvelope[k] = found ? std::min(target - peak, (uint32_t)0xFFFF) : 0xFFFF;
+  }
+}
+
+// Milliseconds from the last kick at or before millisAgo to that instant, 0xFFFF if none
+uint16_t millisSincePeakAt(uint16_t millisAgo) {
+  byte k = millisAgo >> BASS_ENVELOPE_STEP_SHIFT;
+  if (k + 1 >= BASS_ENVELOPE_SIZE) return millisSincePeakBefore(currentMillis - millisAgo);
+
+  updateBassEnvelope();
+  byte offset = millisAgo & ((1 << BASS_ENVELOPE_STEP_SHIFT) - 1);
+  if (bassEnvelope[k] != 0xFFFF && bassEnvelope[k] >= offset) return bassEnvelope[k] - offset;
+  // the kick falls between this entry and the next older one (or there is none)
+  if (bassEnvelope[k + 1] == 0xFFFF) return 0xFFFF;
+  return bassEnvelope[k + 1] + ((1 << BASS_ENVELOPE_STEP_SHIFT) - offset);
+}
+
 // The distance from millis ago to its preceding bass peak. Distance function is linear decrease
 // over fadeDurationMillis and output is mapped to toMin and toMax.
 uint8_t fadedBassValueAt(long millisAgo, uint16_t fadeDurationMillis, uint8_t toMin = 0, uint8_t toMax = 170) {
-  long targetMillis = currentMillis - millisAgo;
-  for (int i = rollingPeaks.size() - 1; i >= 0; i--) {
-    if (targetMillis >= rollingPeaks[i]) {
-      // That means our target time we're trying to find the value of came after this bass peak,
-      // so we need to calculate the easing down to 0 from that peak and where the target time falls
-      uint32_t fadeEnd = rollingPeaks[i] + fadeDurationMillis;
-      if (targetMillis > fadeEnd) {
-        return toMin;
-      }
-      return map(targetMillis, fadeEnd, rollingPeaks[i], toMin, toMax);
-    }
+  uint16_t sincePeak = millisSincePeakAt(millisAgo);
+  if (sincePeak > fadeDurationMillis) {
+    return toMin;
   }
-
-  return toMin;
+  return map(sincePeak, fadeDurationMillis, 0, toMin, toMax);
 }
 
 #define analyzerFadeFactor 5
-#define analyzerScaleFactor 1.5
+#define analyzerScaleFactor toQ8(1 / 1.5)
 #define analyzerPaletteFactor 2
-void customAnalyzer() {
-  // startup tasks
-  if (effectInit == false) {
-    effectInit = true;
-    effectDelay = 10;
+struct CustomAnalyzer : Effect {
+  static const uint8_t symmetry = SYMMETRY_MIRROR;
+
+  static void init(State& s) {
     selectRandomAudioPalette();
     fadeActive = 0;
   }
 
-  CRGB pixelColor;
-
-  const float yScale = 255.0 / kMatrixHeight;
+  static uint16_t interval(const State& s) {
+    return 10;
+  }
 
-  for (byte x = 0; x < kMatrixWidth / 2; x++) {
-    for (byte y = 0; y < kMatrixHeight; y++) {
-      int senseValue = spectrumDecay[x] / analyzerScaleFactor - mapToByteRange(y, kMatrixHeight - 1, 0);
+  static void render(State& s) {
+    for (VisiblePixel p = symmetricPixels(symmetry); p.next(); ) {
+      int senseValue = ((uint32_t)spectrumDecayLevel(p.x) * analyzerScaleFactor >> 8) - mapToByteRange(p.y, kMatrixHeight - 1, 0);
       uint8_t pixelPaletteIndex = constrain(senseValue / analyzerPaletteFactor - 15, 0, 240);
       uint8_t pixelBrightness = constrain(senseValue * analyzerFadeFactor, 0, 255);
       // uint8_t pixelBrightnessMultiplier = mapToHistoricalBassPeaks(0, 0, 100, 600);
 
-      pixelColor = ColorFromPalette(currentPalette, pixelPaletteIndex, pixelBrightness);
-
-      leds[XY(x, y)] = pixelColor;
-      leds[XY(kMatrixWidth - x - 1, y)] = pixelColor;
+      leds[p.index] = paletteColor(pixelPaletteIndex, pixelBrightness);
     }
   }
 
-  overlaySideBeat();
-  overlayTopLineBeatPrediction();
-}
+  static void overlay(State& s) {
+    overlaySideBeat();
+    overlayTopLineBeatPrediction();
+  }
+};
+
+// Spiral around the middle of each lens, at (3, 2) on the left
+typedef PolarTable<6, 4> SpiralPolar;
 
-void pulseSpiral() {
-  // startup tasks
-  if (effectInit == false) {
-    effectInit = true;
-    effectDelay = 10;
+struct PulseSpiral : Effect {
+  static const uint8_t symmetry = SYMMETRY_MIRROR;
+
+  static void init(State& s) {
     selectRandomAudioPalette();
     fadeActive = 0;
   }
 
-  CRGB pixelColor;
-
-  const float yScale = 255.0 / kMatrixHeight;
-
-  for (byte x = 0; x < kMatrixWidth / 2; x++) {
-    for (byte y = 0; y < kMatrixHeight; y++) {
-      int adjustedX = x - 3;
-      int adjustedY = y - 2;
-      // From -PI to PI
-      float theta = atan2f(adjustedX, adjustedY);
-      float distance = hypot(adjustedX, adjustedY);
+  static uint16_t interval(const State& s) {
+    return 10;
+  }
 
-      uint8_t pixelPaletteIndex = mapToByteRange((theta + distance) * 100, (-PI + 0) * 100, (PI + 5) * 100) - currentMillis / 8;
-      uint8_t pixelBrightness = fadedBassValueAt(mapToMillisAgo(distance * 100, 0, 5 * 100, 400), 500);
+  static void render(State& s) {
+    for (VisiblePixel p = symmetricPixels(symmetry); p.next(); ) {
+      // theta measured from +y towards +x, from -128 to 128 (-PI to PI)
+      int16_t theta = (int8_t)(64 - pgm_read_byte(&SpiralPolar::angle[p.index]));
+      uint8_t distanceQ4 = pgm_read_byte(&SpiralPolar::distance[p.index]);
+      if (theta == -128) theta = 128;
+      if (distanceQ4 == 0) theta = 0; // the centre pixel, atan2f(0, 0)
+
+      // (theta + distance) * 100, theta in radians and distance in pixels
+      int16_t spiral = theta * 157 / 64 + distanceQ4 * 25 / 4;
+      uint8_t pixelPaletteIndex = mapToByteRange(spiral, -314, 814) - currentMillis / 8;
+      // distance * 100 mapped from 0-500 to 0-400 ms ago
+      uint8_t pixelBrightness = fadedBassValueAt(distanceQ4 * 5, 500);
       // uint8_t pixelBrightness = mapFromByteRange(pixelPaletteIndex, 0, 150);
 
-      pixelColor = ColorFromPalette(currentPalette, pixelPaletteIndex, pixelBrightness);
-
-      leds[XY(x, y)] = pixelColor;
-      leds[XY(kMatrixWidth - x - 1, y)] = pixelColor;
+      leds[p.index] = paletteColor(pixelPaletteIndex, pixelBrightness);
     }
   }
-  
-  overlaySideBeat();
-  overlayTopLineBeatPrediction();
-}
 
-// Scanning pattern left/right, uses global hue cycle
-void rider() {
+  static void overlay(State& s) {
+    overlaySideBeat();
+    overlayTopLineBeatPrediction();
+  }
+};
 
-  static byte riderPos = 0;
+// Scanning pattern left/right, uses global hue cycle
+struct Rider : Effect {
+  struct State {
+    byte riderPos;
+  };
 
-  // startup tasks
-  if (effectInit == false) {
-    effectInit = true;
-    effectDelay = 5;
-    riderPos = 0;
+  static void init(State& s) {
     fadeActive = 0;
   }
 
-  float bassAdjustment = fadedBassValueAt(0, 500, 50, 255) / 255.0;
+  static uint16_t interval(const State& s) {
+    return 5;
+  }
+
+  static void render(State& s) {
+    uint8_t bassAdjustment = fadedBassValueAt(0, 500, 50, 255);
 
-  // Draw one frame of the animation into the LED array
-  for (byte x = 0; x < kMatrixWidth; x++) {
-    int brightness = abs(x * (256 / kMatrixWidth) - triwave8(riderPos) * 2 + 127) * 3;
-    if (brightness > 255) brightness = 255;
-    brightness = 255 - brightness;
+    // Draw one frame of the animation into the LED array, one color per column
+    CRGB riderColors[kMatrixWidth];
+    for (byte x = 0; x < kMatrixWidth; x++) {
+      int brightness = abs(x * (256 / kMatrixWidth) - triwave8(s.riderPos) * 2 + 127) * 3;
+      if (brightness > 255) brightness = 255;
+      brightness = 255 - brightness;
 
-    brightness *= bassAdjustment;
+      brightness = scale8(brightness, bassAdjustment);
 
-    CRGB riderColor = CHSV(cycleHue, 255, brightness);
-    for (byte y = 0; y < kMatrixHeight; y++) {
-      leds[XY(x, y)] = riderColor;
+      riderColors[x] = CHSV(cycleHue, 255, brightness);
+    }
+    for (VisiblePixel p; p.next(); ) {
+      leds[p.index] = riderColors[p.x];
     }
-  }
 
-  riderPos++; // byte wraps to 0 at 255, triwave8 is also 0-255 periodic
-}
+    s.riderPos++; // byte wraps to 0 at 255, triwave8 is also 0-255 periodic
+  }
+};
 
 // Random pixels scroll sideways, uses current hue
 #define rainDir 0
-void sideRain() {
+struct SideRain : Effect {
+  struct State {
+    uint16_t xQ8; // scroll phase
+  };
 
-  static float x = 0;
-
-  // startup tasks
-  if (effectInit == false) {
-    effectInit = true;
-    effectDelay = 10;
+  static void init(State& s) {
     fadeActive = 0;
   }
 
-  // uint8_t brightness = fadedBassValueAt(0, 200, 0, 255);
-
-  x += constrain((spectrumDecay[0] + spectrumDecay[1]) / 600.0, 0.01, 0.9) * 2.3;
-  while (x >= 1.0) {
-    scrollArray(rainDir);
-    x -= 1.0;
+  static uint16_t interval(const State& s) {
+    return 10;
   }
-  byte randPixel = random8(kMatrixHeight);
-  for (byte y = 0; y < kMatrixHeight; y++) leds[XY((kMatrixWidth - 1) * rainDir, y)] = CRGB::Black;
-  if ((spectrumDecay[4] + spectrumDecay[5]) * 1.01 >= spectrumPeaks[4] + spectrumPeaks[5]) {
-    leds[XY((kMatrixWidth - 1)*rainDir, randPixel)] = ColorFromPalette(currentPalette, cycleHue, 255);
+
+  static void render(State& s) {
+    // uint8_t brightness = fadedBassValueAt(0, 200, 0, 255);
+
+    uint16_t speedQ8 = audioSpeedQ8(spectrumDecayLevel(0) + spectrumDecayLevel(1), 600, toQ8(0.01), toQ8(0.9), toQ8(2.3));
+    for (byte steps = advancePhase(s.xQ8, speedQ8); steps > 0; steps--) {
+      scrollArray(rainDir);
+    }
+    byte randPixel = random8(kMatrixHeight);
+    for (byte y = 0; y < kMatrixHeight; y++) leds[XY((kMatrixWidth - 1) * rainDir, y)] = CRGB::Black;
+    if ((spectrumDecayQ8[4] + spectrumDecayQ8[5]) * 101 >= (spectrumPeaksQ8[4] + spectrumPeaksQ8[5]) * 100) {
+      leds[XY((kMatrixWidth - 1)*rainDir, randPixel)] = paletteColor(cycleHue);
+    }
   }
-}
+};
 
 // Draw slanting bars scrolling across the array, uses current hue
-void slantBars() {
-
-  static float x = 0;
-  static byte slantPos = 0;
+struct SlantBars : Effect {
+  struct State {
+    uint16_t slantPosQ8; // bar position, wraps with sin8
+  };
 
-  // startup tasks
-  if (effectInit == false) {
-    effectInit = true;
-    effectDelay = 5;
+  static void init(State& s) {
     fadeActive = 0;
   }
-  
-  x += constrain((spectrumDecay[0] + spectrumDecay[1]) / 600.0, 0.01, 0.9) * 20.0;
-  while (x >= 1.0) {
-    slantPos += 1;
-    x -= 1.0;
+
+  static uint16_t interval(const State& s) {
+    return 5;
   }
 
-  for (byte x = 0; x < kMatrixWidth; x++) {
-    for (byte y = 0; y < kMatrixHeight; y++) {
-      leds[XY(x, y)] = CHSV(cycleHue, 255, sin8(x * 32 + y * 32 + slantPos));
+  static void render(State& s) {
+    s.slantPosQ8 += audioSpeedQ8(spectrumDecayLevel(0) + spectrumDecayLevel(1), 600, toQ8(0.01), toQ8(0.9), toQ8(20));
+    byte slantPos = s.slantPosQ8 >> 8;
+
+    for (VisiblePixel p; p.next(); ) {
+      leds[p.index] = CHSV(cycleHue, 255, sin8(p.x * 32 + p.y * 32 + slantPos));
     }
   }
-}
\ No newline at end of file
+};
\ No newline at end of file
@@ -1,189 +1,211 @@
 //   Graphical effects to run on the RGB Shades LED array
-//   Each function should have the following components:
-//    * Must be declared void with no parameters or will break function pointer array
-//    * Check effectInit, if false then init any required settings and set effectInit true
-//    * Set effectDelay (the time in milliseconds until the next run of this effect)
-//    * All animation should be controlled with counters and effectDelay, no delay() or loops
+//   Each effect is a struct following the interface in registry.h:
+//    * Keep animation counters in State, not in statics; it is zeroed when the effect is selected
+//    * init() sets up any required settings (fadeActive, palettes)
+//    * interval() returns the time in milliseconds until the next render
+//    * All animation should be controlled with counters and interval(), no delay() or loops
 //    * Pixel data should be written using leds[XY(x,y)] to map coordinates to the RGB Shades layout
 
 // Triple Sine Waves
-void threeSine() {
+struct ThreeSine : Effect {
+  struct State {
+    byte sineOffset; // counter for current position of sine waves
+  };
 
-  static byte sineOffset = 0; // counter for current position of sine waves
-
-  // startup tasks
-  if (effectInit == false) {
-    effectInit = true;
-    effectDelay = 20;
+  static void init(State& s) {
     fadeActive = 0;
   }
 
-  // Draw one frame of the animation into the LED array
-  for (byte x = 0; x < kMatrixWidth; x++) {
-    for (int y = 0; y < kMatrixHeight; y++) {
+  static uint16_t interval(const State& s) {
+    return 20;
+  }
 
+  static void render(State& s) {
+    // Draw one frame of the animation into the LED array
+    for (VisiblePixel p; p.next(); ) {
       // Calculate "sine" waves with varying periods
       // sin8 is used for speed; cos8, quadwave8, or triwave8 would also work here
-      byte sinDistanceR = qmul8(abs(y * (255 / kMatrixHeight) - sin8(sineOffset * 9 + x * 16)), 2);
-      byte sinDistanceG = qmul8(abs(y * (255 / kMatrixHeight) - sin8(sineOffset * 10 + x * 16)), 2);
-      byte sinDistanceB = qmul8(abs(y * (255 / kMatrixHeight) - sin8(sineOffset * 11 + x * 16)), 2);
+      int y = p.y;
+      byte sinDistanceR = qmul8(abs(y * (255 / kMatrixHeight) - sin8(s.sineOffset * 9 + p.x * 16)), 2);
+      byte sinDistanceG = qmul8(abs(y * (255 / kMatrixHeight) - sin8(s.sineOffset * 10 + p.x * 16)), 2);
+      byte sinDistanceB = qmul8(abs(y * (255 / kMatrixHeight) - sin8(s.sineOffset * 11 + p.x * 16)), 2);
 
-      leds[XY(x, y)] = CRGB(255 - sinDistanceR, 255 - sinDistanceG, 255 - sinDistanceB);
+      leds[p.index] = CRGB(255 - sinDistanceR, 255 - sinDistanceG, 255 - sinDistanceB);
     }
-  }
 
-  sineOffset++; // byte will wrap from 255 to 0, matching sin8 0-255 cycle
-
-}
+    s.sineOffset++; // byte will wrap from 255 to 0, matching sin8 0-255 cycle
+  }
+};
 
 // Fills saturated colors into the array from alternating directions
-void colorFill() {
-
-  static byte currentColor = 0;
-  static byte currentRow = 0;
-  static byte currentDirection = 0;
-
-  // startup tasks
-  if (effectInit == false) {
-    effectInit = true;
-    effectDelay = 45;
-    currentColor = 0;
-    currentRow = 0;
-    currentDirection = 0;
-    currentPalette = RainbowColors_p;
+struct ColorFill : Effect {
+  struct State {
+    byte currentColor;
+    byte currentRow;
+    byte currentDirection;
+    uint16_t delay;
+  };
+
+  static void init(State& s) {
+    selectPalette(PALETTE_RAINBOW);
     fadeActive = 0;
   }
 
-  // test a bitmask to fill up or down when currentDirection is 0 or 2 (0b00 or 0b10)
-  if (!(currentDirection & 1)) {
-    effectDelay = 45; // slower since vertical has fewer pixels
-    for (byte x = 0; x < kMatrixWidth; x++) {
-      byte y = currentRow;
-      if (currentDirection == 2) y = kMatrixHeight - 1 - currentRow;
-      leds[XY(x, y)] = currentPalette[currentColor];
-    }
+  static uint16_t interval(const State& s) {
+    return s.delay;
   }
 
-  // test a bitmask to fill left or right when currentDirection is 1 or 3 (0b01 or 0b11)
-  if (currentDirection & 1) {
-    effectDelay = 20; // faster since horizontal has more pixels
-    for (byte y = 0; y < kMatrixHeight; y++) {
-      byte x = currentRow;
-      if (currentDirection == 3) x = kMatrixWidth - 1 - currentRow;
-      leds[XY(x, y)] = currentPalette[currentColor];
+  static void render(State& s) {
+    // test a bitmask to fill up or down when currentDirection is 0 or 2 (0b00 or 0b10)
+    if (!(s.currentDirection & 1)) {
+      s.delay = 45; // slower since vertical has fewer pixels
+      for (byte x = 0; x < kMatrixWidth; x++) {
+        byte y = s.currentRow;
+        if (s.currentDirection == 2) y = kMatrixHeight - 1 - s.currentRow;
+        leds[XY(x, y)] = currentPalette[s.currentColor];
+      }
     }
-  }
-
-  currentRow++;
 
-  // detect when a fill is complete, change color and direction
-  if ((!(currentDirection & 1) && currentRow >= kMatrixHeight) || ((currentDirection & 1) && currentRow >= kMatrixWidth)) {
-    currentRow = 0;
-    currentColor += random8(3, 6);
-    if (currentColor > 15) currentColor -= 16;
-    currentDirection++;
-    if (currentDirection > 3) currentDirection = 0;
-    effectDelay = 300; // wait a little bit longer after completing a fill
-  }
+    // test a bitmask to fill left or right when currentDirection is 1 or 3 (0b01 or 0b11)
+    if (s.currentDirection & 1) {
+      s.delay = 20; // faster since horizontal has more pixels
+      for (byte y = 0; y < kMatrixHeight; y++) {
+        byte x = s.currentRow;
+        if (s.currentDirection == 3) x = kMatrixWidth - 1 - s.currentRow;
+        leds[XY(x, y)] = currentPalette[s.currentColor];
+      }
+    }
 
+    s.currentRow++;
 
-}
+    // detect when a fill is complete, change color and direction
+    if ((!(s.currentDirection & 1) && s.currentRow >= kMatrixHeight) || ((s.currentDirection & 1) && s.currentRow >= kMatrixWidth)) {
+      s.currentRow = 0;
+      s.currentColor += random8(3, 6);
+      if (s.currentColor > 15) s.currentColor -= 16;
+      s.currentDirection++;
+      if (s.currentDirection > 3) s.currentDirection = 0;
+      s.delay = 300; // wait a little bit longer after completing a fill
+    }
+  }
+};
 
 // Pixels with random locations and random colors selected from a palette
-// Use with the fadeAll function to allow old pixels to decay
-void confetti() {
-
-  // startup tasks
-  if (effectInit == false) {
-    effectInit = true;
-    effectDelay = 10;
+// Use with fadeActive to allow old pixels to decay
+struct Confetti : Effect {
+  static void init(State& s) {
     selectRandomAudioPalette();
     fadeActive = 10;
   }
-  byte brightness = map(spectrumDecay[1], 300, spectrumPeaks[1], 0, 255);
 
-  // scatter random colored pixels at several random coordinates
-  for (byte i = 0; i < 4; i++) {
-    leds[XY(random16(kMatrixWidth), random16(kMatrixHeight))] = ColorFromPalette(currentPalette, random16(255), brightness); //CHSV(random16(255), 255, 255);
-    random16_add_entropy(1);
+  static uint16_t interval(const State& s) {
+    return 10;
   }
 
-}
+  static void render(State& s) {
+    byte brightness = levelToByte(spectrumDecayLevel(1), 300, spectrumPeakLevel(1));
+
+    // scatter random colored pixels at several random coordinates
+    for (byte i = 0; i < 4; i++) {
+      leds[XY(random16(kMatrixWidth), random16(kMatrixHeight))] = paletteColor(random16(255), brightness); //CHSV(random16(255), 255, 255);
+      random16_add_entropy(1);
+    }
+  }
+};
 
 #define VUFadeFactor 5
-#define VUScaleFactor 2.0
-#define VUPaletteFactor 1.5
-void drawVU() {
-  // startup tasks
-  if (effectInit == false) {
-    effectInit = true;
-    effectDelay = 10;
+#define VUScaleFactor 2
+#define VUPaletteFactor toQ8(1 / 1.5)
+struct DrawVU : Effect {
+  static const uint8_t symmetry = SYMMETRY_MIRROR;
+
+  static void init(State& s) {
     selectRandomAudioPalette();
     fadeActive = 0;
   }
 
-  CRGB pixelColor;
+  static uint16_t interval(const State& s) {
+    return 10;
+  }
+
+  static void render(State& s) {
+    CRGB columnColors[kMatrixWidth / 2];
 
-  const float xScale = 255.0 / (kMatrixWidth / 2);
-  float specCombo = (spectrumDecay[0] + spectrumDecay[1] + spectrumDecay[2] + spectrumDecay[3]) / 4.0;
+    uint16_t specSum = spectrumDecayLevel(0) + spectrumDecayLevel(1) + spectrumDecayLevel(2) + spectrumDecayLevel(3);
 
-  for (byte x = 0; x < kMatrixWidth / 2; x++) {
-    int senseValue = specCombo / VUScaleFactor - xScale * x;
-    int pixelBrightness = constrain(senseValue * VUFadeFactor, 0, 255);
-    int pixelPaletteIndex = constrain(senseValue / VUPaletteFactor - 15, 0, 240);
+    for (byte x = 0; x < kMatrixWidth / 2; x++) {
+      int senseValue = specSum / (4 * VUScaleFactor) - x * 255 / (kMatrixWidth / 2);
+      int pixelBrightness = constrain(senseValue * VUFadeFactor, 0, 255);
+      int pixelPaletteIndex = constrain(((int32_t)senseValue * VUPaletteFactor >> 8) - 15, 0, 240);
 
-    pixelColor = ColorFromPalette(currentPalette, pixelPaletteIndex, pixelBrightness);
+      columnColors[x] = paletteColor(pixelPaletteIndex, pixelBrightness);
+    }
 
-    for (byte y = 0; y < kMatrixHeight; y++) {
-      leds[XY(x, y)] = pixelColor;
-      leds[XY(kMatrixWidth - x - 1, y)] = pixelColor;
+    for (VisiblePixel p = symmetricPixels(symmetry); p.next(); ) {
+      leds[p.index] = columnColors[p.x];
     }
   }
-}
+};
 
 //leds run around the periphery of the shades
-void audioShadesOutline() {
-  
-  static float x = 0;
-  
-  //startup tasks
-  if (effectInit == false) {
-    effectInit = true;
-    effectDelay = 15;
-    FastLED.clear();
-    currentPalette = RainbowColors_p;
+struct AudioShadesOutline : Effect {
+  struct State {
+    uint16_t xQ8; // position along the outline
+  };
+
+  static void init(State& s) {
+    fillAll(CRGB::Black);
+    selectPalette(PALETTE_RAINBOW);
     fadeActive = 10;
   }
 
-  int brightness = std::min(static_cast<int>(spectrumDecay[0] + spectrumDecay[1]), 255);
-
-  CRGB pixelColor = CHSV(cycleHue, 255, brightness);
-  
-  for (byte k = 0; k < 4; k++) {
-    leds[OutlineMap(x+(OUTLINESIZE/4-1)*k)] += pixelColor;
+  static uint16_t interval(const State& s) {
+    return 15;
   }
 
-  x += constrain((spectrumDecay[0] + spectrumDecay[1]) / 600.0, 0.1, 0.6);
-  
-  if (x > (OUTLINESIZE-1)) x = 0;
-  if (x < 0) x = OUTLINESIZE - 1;
-}
+  static void render(State& s) {
+    int brightness = std::min<uint16_t>(spectrumDecayLevel(0) + spectrumDecayLevel(1), 255);
 
-// Ring pulser
+    CRGB pixelColor = CHSV(cycleHue, 255, brightness);
 
-void drawRing(int xCenter, int yCenter, float radius, CRGB color) {
-  int brightness;
-  CRGB tempColor;
-
-  if (radius > 13) radius = 13;
-  
-  for (int x = 0; x < kMatrixWidth; x++) {
-    for (int y = 0; y < kMatrixHeight; y++) {
-      brightness = 255 - abs((hypot((float)x - 7.5 - xCenter/256.0, (float)y - 2.0 - yCenter/256.0) - radius)*192.0);
-      if (brightness > 255) brightness = 255;
-      if (brightness < 0) brightness = 0;
-      tempColor = color;
-      leds[XY(x, y)] += tempColor.nscale8(brightness);
+    for (byte k = 0; k < 4; k++) {
+      leds[OutlineMap((s.xQ8 >> 8) + (OUTLINESIZE/4-1)*k)] += pixelColor;
     }
+
+    s.xQ8 += audioSpeedQ8(spectrumDecayLevel(0) + spectrumDecayLevel(1), 600, toQ8(0.1), toQ8(0.6));
+
+    if (s.xQ8 > (OUTLINESIZE-1) << 8) s.xQ8 = 0;
+  }
+};
+
+// Ring pulser
+
+// Rings are centred on the bridge of the nose, (7.5, 2)
+typedef PolarTable<15, 4> RingPolar;
+
+// xCenter and yCenter move the centre in 1/256 pixels (accurate up to about
+// half a pixel), radiusQ4 is in 1/16 pixels
+void drawRing(int xCenter, int yCenter, uint8_t radiusQ4, CRGB color) {
+  PROFILE_BEGIN(PROFILE_DRAWRING);
+  if (radiusQ4 > 13 * 16) radiusQ4 = 13 * 16;
+  int16_t offsetX = xCenter / 16;
+  int16_t offsetY = yCenter / 16;
+  int16_t offsetSquared = offsetX * offsetX + offsetY * offsetY;
+
+  for (VisiblePixel p; p.next(); ) {
+    // distance from the moved centre, to second order in the offset: the
+    // offset's component along the direction to the pixel, plus a correction
+    // for the component across it
+    uint16_t angle16 = pgm_read_byte(&RingPolar::angle[p.index]) << 8;
+    int16_t along = ((int32_t)xCenter * cos16(angle16) + (int32_t)yCenter * sin16(angle16)) >> 19;
+    int16_t distanceQ4 = pgm_read_byte(&RingPolar::distance[p.index]);
+    if (distanceQ4 > 0) distanceQ4 += (offsetSquared - along * along) / (2 * distanceQ4);
+    distanceQ4 -= along;
+
+    int16_t brightness = 255 - abs(distanceQ4 - radiusQ4) * 12;
+    if (brightness < 0) brightness = 0;
+    CRGB tempColor = color;
+    leds[p.index] += tempColor.nscale8(brightness);
   }
+  PROFILE_END(PROFILE_DRAWRING);
 }
@@ -0,0 +1,196 @@
+// Interrupt-driven MSGEQ7 sampler
+//
+// A one-shot Timer2 compare interrupt sequences the MSGEQ7 reset and strobe
+// lines, and the ADC-complete interrupt accumulates EQ_OVERSAMPLE conversions
+// per band, so loop() never waits on the chip. Each finished frame of 7
+// averaged readings is published through a double buffer: the interrupts fill
+// one half while loop() reads the other, and eqTakeFrame() hands loop() the
+// newest complete frame.
+//
+// Frames start every EQ_FRAME_MICROS from the timer, independent of how long
+// rendering takes. On the host the same state machine runs from simulated
+// interrupts (see host/sim.cpp), which provide the platform functions below.
+
+#define EQ_OVERSAMPLE_SHIFT 2
+#define EQ_OVERSAMPLE (1 << EQ_OVERSAMPLE_SHIFT) // conversions per band, averaged with a shift
+
+// Keep loop()'s old "more than AUDIODELAY ms" cadence so the smoothing constants hold
+#define EQ_FRAME_MICROS ((AUDIODELAY + 1) * 1000UL)
+
+// MSGEQ7 timing
+#define EQ_RESET_MICROS 5            // reset pulse width
+#define EQ_RESET_TO_STROBE_MICROS 72 // reset falling edge to first strobe
+#define EQ_SETTLE_MICROS 36          // strobe falling edge to stable output
+#define EQ_STROBE_HIGH_MICROS 40     // strobe high time between bands
+#define EQ_MAX_WAIT_MICROS 500       // longest single timer delay (Timer2 at 2 us per tick)
+
+#define EQ_IDLE 0
+#define EQ_RESET_HIGH 1
+#define EQ_RESET_LOW 2
+#define EQ_STROBE_LOW 3
+#define EQ_CONVERTING 4
+#define EQ_STROBE_HIGH 5
+
+volatile uint16_t eqFrames[2][7];
+volatile uint8_t eqFront = 0;          // half loop() reads; the interrupts fill the other
+volatile boolean eqFrameReady = false; // a frame was published and not yet taken
+volatile uint16_t eqOverruns = 0;      // frames replaced before loop() took them
+
+uint8_t eqState = EQ_IDLE;
+uint8_t eqBand = 0;
+uint8_t eqSamples = 0;
+uint16_t eqAccumulator = 0;
+uint32_t eqFrameStart = 0;
+
+// Platform layer: one-shot timer, ADC start and the two MSGEQ7 control lines
+void eqSchedule(uint16_t delayMicros);
+void eqStartConversion();
+void eqWriteReset(uint8_t level);
+void eqWriteStrobe(uint8_t level);
+
+// Swap the finished back half to the front
+void eqPublishFrame() {
+  if (eqFrameReady) eqOverruns++;
+  eqFront = !eqFront;
+  eqFrameReady = true;
+}
+
+// Timer event: advance the reset/strobe sequence
+void eqTimerEvent() {
+  switch (eqState) {
+
+    case EQ_IDLE: {
+      uint32_t elapsed = micros() - eqFrameStart;
+      if (elapsed < EQ_FRAME_MICROS) {
+        uint32_t wait = EQ_FRAME_MICROS - elapsed;
+        eqSchedule(wait < EQ_MAX_WAIT_MICROS ? wait : EQ_MAX_WAIT_MICROS);
+        break;
+      }
+      // stay on the frame grid unless we fell a whole frame behind
+      eqFrameStart = elapsed < 2 * EQ_FRAME_MICROS ? eqFrameStart + EQ_FRAME_MICROS : micros();
+      eqWriteReset(HIGH);
+      eqState = EQ_RESET_HIGH;
+      eqSchedule(EQ_RESET_MICROS);
+      break;
+    }
+
+    case EQ_RESET_HIGH:
+      eqWriteReset(LOW);
+      eqBand = 0;
+      eqState = EQ_RESET_LOW;
+      eqSchedule(EQ_RESET_TO_STROBE_MICROS);
+      break;
+
+    case EQ_RESET_LOW:
+    case EQ_STROBE_HIGH:
+      eqWriteStrobe(LOW);
+      eqState = EQ_STROBE_LOW;
+      eqSchedule(EQ_SETTLE_MICROS);
+      break;
+
+    case EQ_STROBE_LOW:
+      eqSamples = 0;
+      eqAccumulator = 0;
+      eqState = EQ_CONVERTING;
+      eqStartConversion();
+      break;
+  }
+}
+
+// ADC event: accumulate one conversion of the current band
+void eqConversionDone(uint16_t reading) {
+  eqAccumulator += reading;
+  if (++eqSamples < EQ_OVERSAMPLE) {
+    eqStartConversion();
+    return;
+  }
+
+  eqFrames[!eqFront][eqBand] = eqAccumulator >> EQ_OVERSAMPLE_SHIFT;
+  eqWriteStrobe(HIGH);
+
+  if (++eqBand < 7) {
+    eqState = EQ_STROBE_HIGH;
+    eqSchedule(EQ_STROBE_HIGH_MICROS);
+  } else {
+    eqPublishFrame();
+    eqState = EQ_IDLE;
+    eqTimerEvent();
+  }
+}
+
+// Copy the newest finished frame; returns false if none is waiting
+boolean eqTakeFrame(unsigned int* values) {
+  if (!eqFrameReady) return false;
+  noInterrupts();
+  for (byte i = 0; i < 7; i++) {
+    values[i] = eqFrames[eqFront][i];
+  }
+  eqFrameReady = false;
+  interrupts();
+  return true;
+}
+
+#ifdef __AVR__
+
+volatile uint8_t* eqResetPort;
+volatile uint8_t* eqStrobePort;
+uint8_t eqResetMask;
+uint8_t eqStrobeMask;
+
+void eqSchedule(uint16_t delayMicros) {
+  uint8_t ticks = delayMicros / 2;
+  OCR2A = ticks ? ticks - 1 : 0;
+  TCNT2 = 0;
+  TIFR2 = _BV(OCF2A);
+  TIMSK2 = _BV(OCIE2A);
+}
+
+void eqStartConversion() {
+  ADCSRA |= _BV(ADSC);
+}
+
+void eqWriteReset(uint8_t level) {
+  if (level) *eqResetPort |= eqResetMask;
+  else *eqResetPort &= ~eqResetMask;
+}
+
+void eqWriteStrobe(uint8_t level) {
+  if (level) *eqStrobePort |= eqStrobeMask;
+  else *eqStrobePort &= ~eqStrobeMask;
+}
+
+ISR(TIMER2_COMPA_vect) {
+  TIMSK2 = 0; // one-shot
+  eqTimerEvent();
+}
+
+ISR(ADC_vect) {
+  eqConversionDone(ADC);
+}
+
+// Start sampling; the pins must already be outputs with STROBEPIN high
+void eqSamplerBegin() {
+  eqResetPort = portOutputRegister(digitalPinToPort(RESETPIN));
+  eqResetMask = digitalPinToBitMask(RESETPIN);
+  eqStrobePort = portOutputRegister(digitalPinToPort(STROBEPIN));
+  eqStrobeMask = digitalPinToBitMask(STROBEPIN);
+
+  // Timer2: CTC, clk/32 = 2 us per tick
+  TCCR2A = _BV(WGM21);
+  TCCR2B = _BV(CS21) | _BV(CS20);
+  TIMSK2 = 0;
+
+  // ADC: AVcc reference, ANALOGPIN, interrupt on completion, clk/128
+  ADMUX = _BV(REFS0) | (ANALOGPIN & 0x07);
+  ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+
+  eqState = EQ_IDLE;
+  eqFrameStart = micros() - EQ_FRAME_MICROS;
+  eqSchedule(EQ_RESET_MICROS);
+}
+
+#else
+
+void eqSamplerBegin();
+
+#endif
@@ -0,0 +1,408 @@
+// Cycle-accurate profiler for the RaveShades firmware under simavr
+//
+// Loads a firmware built with -DPROFILE_CYCLES (see profile.h), emulates the
+// MSGEQ7 on the strobe/reset pins and ADC3 with a synthetic beat, and
+// timestamps every PROFILE_BEGIN/PROFILE_END write to GPIOR0 with simavr's
+// cycle counter. Prints min/mean/max cycles per call for each marker and exits
+// non-zero if any marker's worst case exceeds its budget, or if a budgeted
+// marker never ran (so a budget can't silently check nothing).
+//
+// It also checks the firmware's strobe/reset/ADC sequencing (eqsampler.h)
+// against the MSGEQ7 datasheet timing: seven strobes after each reset, every
+// conversion taken while the strobe is low and after the output has settled,
+// EQ_OVERSAMPLE conversions per band. Any violation fails the run, as does a
+// run with no complete frame.
+//
+// With --measure PCT it rewrites the budgets file instead of checking it: every
+// budgeted marker that ran gets its measured worst case plus PCT percent,
+// rounded up to 100 cycles, and its comment is kept.
+//
+//   ./avr_profile -f RaveShades.ino.elf [-b budgets.txt] [-s seconds] [--bpm N] [--measure PCT]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "avr_ioport.h"
+#include "avr_adc.h"
+#include "avr_uart.h"
+
+#define CPU_FREQUENCY 16000000UL
+#define GPIOR0_ADDR 0x3E   // data-space address of GPIOR0 on the ATmega328
+
+#define MARKER_COUNT 0x80
+#define MARKER_END 0x80
+
+// pin mapping from audio.h: STROBEPIN 8 = PB0, RESETPIN 7 = PD7, ANALOGPIN 3 = ADC3
+#define STROBE_PORT 'B'
+#define STROBE_BIT 0
+#define RESET_PORT 'D'
+#define RESET_BIT 7
+
+// MSGEQ7 datasheet minimums, in microseconds
+#define EQ_RESET_TO_STROBE_MIN 72
+#define EQ_STROBE_WIDTH_MIN 18
+#define EQ_STROBE_TO_STROBE_MIN 72
+#define EQ_SETTLE_MIN 36
+#define EQ_CONVERSIONS_PER_BAND 4 // EQ_OVERSAMPLE in eqsampler.h
+
+typedef struct {
+  uint64_t begin;
+  uint32_t count;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+  uint64_t budget;   // 0 = unbudgeted
+} marker_t;
+
+static marker_t markers[MARKER_COUNT];
+static avr_t* avr;
+static int eq_band = -1;
+static unsigned bpm = 128;
+static uint32_t noise_seed = 12345;
+
+// MSGEQ7 sequencing check
+static int strobe_level = 1;
+static int reset_level = 0;
+static uint64_t reset_fall = 0;       // cycle of the last reset falling edge
+static uint64_t strobe_fall = 0;      // cycle of the last strobe falling edge
+static uint64_t strobe_rise = 0;      // cycle of the last strobe rising edge
+static int strobes_since_reset = -1;  // -1 until the first reset
+static int conversions_this_band = 0;
+static unsigned long eq_frames = 0;
+static unsigned long eq_violations = 0;
+
+static double cycles_to_us(uint64_t cycles) {
+  return cycles * 1000000.0 / CPU_FREQUENCY;
+}
+
+static void eq_violation(const char* what, double us) {
+  if (eq_violations++ < 10) {
+    fprintf(stderr, "MSGEQ7 sequencing at %.3f ms: %s (%.1f us)\n", cycles_to_us(avr->cycle) / 1000, what, us);
+  }
+}
+
+static const char* marker_name(uint8_t id, char* buf, size_t len) {
+  switch (id) {
+    case 0x01: return "doAnalogs";
+    case 0x02: return "renderOutput";
+    case 0x03: return "FastLED.show";
+    case 0x04: return "drawRing";
+    case 0x05: return "buttons";
+    case 0x06: return "checkEEPROM";
+    case 0x07: return "paletteBlend";
+    case 0x08: return "loop";
+  }
+  if (id >= 0x10) {
+    snprintf(buf, len, "effect%u", id - 0x10);
+    return buf;
+  }
+  snprintf(buf, len, "marker%u", id);
+  return buf;
+}
+
+static void gpior_write(struct avr_t* avr, avr_io_addr_t addr, uint8_t v, void* param) {
+  (void)param;
+  avr->data[addr] = v;
+
+  marker_t* m = &markers[v & ~MARKER_END];
+  if (!(v & MARKER_END)) {
+    m->begin = avr->cycle;
+    return;
+  }
+  if (!m->begin) return;
+
+  uint64_t cycles = avr->cycle - m->begin;
+  m->begin = 0;
+  m->count++;
+  m->total += cycles;
+  if (!m->min || cycles < m->min) m->min = cycles;
+  if (cycles > m->max) m->max = cycles;
+}
+
+static uint16_t noise(uint16_t amplitude) {
+  noise_seed = noise_seed * 1103515245u + 12345u;
+  return (noise_seed >> 16) % (amplitude + 1);
+}
+
+// Same four-on-the-floor pattern as the host simulator, in ADC counts
+static uint16_t synthetic_band(int band) {
+  double now_ms = avr->cycle * 1000.0 / CPU_FREQUENCY;
+  double beat_ms = 60000.0 / bpm;
+  unsigned beat = (unsigned)(now_ms / beat_ms);
+  double since_beat = fmod(now_ms, beat_ms);
+  double since_eighth = fmod(now_ms, beat_ms / 2);
+
+  double level = 90;
+  if (band <= 1) {
+    level += 750 * exp(-since_beat / 70.0);
+  } else if (band <= 4) {
+    if (beat % 2 == 1) level += 450 * exp(-since_beat / 90.0);
+  } else {
+    level += 300 * exp(-since_eighth / 30.0);
+  }
+  level += noise(40);
+  return level > 1023 ? 1023 : (uint16_t)level;
+}
+
+static void strobe_changed(struct avr_irq_t* irq, uint32_t value, void* param) {
+  (void)irq; (void)param;
+  if (!value == !strobe_level) return;
+  strobe_level = value != 0;
+
+  if (!value) {
+    eq_band = (eq_band + 1) % 7;
+    if (strobes_since_reset >= 0) {
+      if (strobes_since_reset == 0 && cycles_to_us(avr->cycle - reset_fall) < EQ_RESET_TO_STROBE_MIN) {
+        eq_violation("reset to first strobe too short", cycles_to_us(avr->cycle - reset_fall));
+      }
+      if (strobes_since_reset > 0 && cycles_to_us(avr->cycle - strobe_fall) < EQ_STROBE_TO_STROBE_MIN) {
+        eq_violation("strobe to strobe too short", cycles_to_us(avr->cycle - strobe_fall));
+      }
+      if (++strobes_since_reset > 7) eq_violation("more than 7 strobes after a reset", 0);
+    }
+    strobe_fall = avr->cycle;
+    conversions_this_band = 0;
+  } else {
+    strobe_rise = avr->cycle;
+    if (strobes_since_reset > 0) {
+      if (cycles_to_us(strobe_rise - strobe_fall) < EQ_STROBE_WIDTH_MIN) {
+        eq_violation("strobe low too short", cycles_to_us(strobe_rise - strobe_fall));
+      }
+      if (conversions_this_band != EQ_CONVERSIONS_PER_BAND) {
+        eq_violation("wrong number of conversions for a band", conversions_this_band);
+      }
+      if (strobes_since_reset == 7) eq_frames++;
+    }
+  }
+}
+
+static void reset_changed(struct avr_irq_t* irq, uint32_t value, void* param) {
+  (void)irq; (void)param;
+  if (!value == !reset_level) return;
+  reset_level = value != 0;
+
+  if (value) {
+    if (strobes_since_reset > 0 && strobes_since_reset < 7) eq_violation("reset before all 7 bands were read", 0);
+    eq_band = -1;
+    strobes_since_reset = -1;
+  } else {
+    reset_fall = avr->cycle;
+    strobes_since_reset = 0;
+  }
+}
+
+// Called when a conversion starts; present the current band on ADC3 in millivolts
+static void adc_triggered(struct avr_irq_t* irq, uint32_t value, void* param) {
+  (void)irq; (void)value; (void)param;
+  if (strobes_since_reset > 0) {
+    if (strobe_level) {
+      eq_violation("conversion with the strobe high", 0);
+    } else if (cycles_to_us(avr->cycle - strobe_fall) < EQ_SETTLE_MIN) {
+      eq_violation("conversion before the output settled", cycles_to_us(avr->cycle - strobe_fall));
+    }
+    conversions_this_band++;
+  }
+  uint16_t counts = eq_band < 0 ? noise(20) : synthetic_band(eq_band);
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC3), counts * 5000UL / 1023);
+}
+
+// budgets file: one "<marker name> <max cycles>" per line, '#' starts a comment
+static int load_budgets(const char* path) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+
+  char line[128];
+  while (fgets(line, sizeof(line), f)) {
+    char* hash = strchr(line, '#');
+    if (hash) *hash = 0;
+
+    char name[64];
+    unsigned long long cycles;
+    if (sscanf(line, "%63s %llu", name, &cycles) != 2) continue;
+
+    for (int id = 1; id < MARKER_COUNT; id++) {
+      char buf[16];
+      if (!strcmp(name, marker_name(id, buf, sizeof(buf)))) markers[id].budget = cycles;
+    }
+  }
+  fclose(f);
+  return 0;
+}
+
+// rewrites each "<marker name> <max cycles>" line of the budgets file from the
+// run, and the "# status:" line to say so. Markers that never ran keep their
+// old budget, are reported, and leave the file marked partly measured. Raised
+// budgets are reported too: loop's is a frame period, not just a baseline.
+static int measure_budgets(const char* path, unsigned seconds, unsigned margin) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  char lines[64][128];
+  int count = 0;
+  while (count < 64 && fgets(lines[count], sizeof(lines[count]), f)) count++;
+  int truncated = !feof(f) && fgetc(f) != EOF;
+  fclose(f);
+  if (truncated) {
+    fprintf(stderr, "%s: more than 64 lines, not rewritten\n", path);
+    return -1;
+  }
+
+  uint64_t budgets[64] = {0};   // 0 = line written back unchanged
+  int ends[64];
+  int unreached = 0;
+  for (int i = 0; i < count; i++) {
+    char name[64];
+    unsigned long long cycles;
+    if (lines[i][0] == '#' || sscanf(lines[i], "%63s %llu%n", name, &cycles, &ends[i]) != 2) continue;
+
+    for (int id = 1; id < MARKER_COUNT; id++) {
+      char buf[16];
+      if (strcmp(name, marker_name(id, buf, sizeof(buf)))) continue;
+      if (markers[id].count) {
+        uint64_t budget = (markers[id].max * (100 + margin) + 99) / 100;
+        budgets[i] = (budget + 99) / 100 * 100;
+        if (budgets[i] > cycles) fprintf(stderr, "%s budget raised from %llu to %llu\n", name, cycles,
+                                         (unsigned long long)budgets[i]);
+      } else {
+        fprintf(stderr, "%s never ran, budget left at %llu\n", name, cycles);
+        unreached = 1;
+      }
+      break;
+    }
+  }
+
+  f = fopen(path, "w");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    char name[64];
+    if (!strncmp(lines[i], "# status:", 9)) {
+      fprintf(f, "# status: %s, worst case over %u s at %u bpm plus %u%%\n", unreached ? "partly measured" : "measured",
+              seconds, bpm, margin);
+    } else if (budgets[i] && sscanf(lines[i], "%63s", name) == 1) {
+      fprintf(f, "%-15s%6llu%s", name, (unsigned long long)budgets[i], lines[i] + ends[i]);
+    } else {
+      fputs(lines[i], f);
+    }
+  }
+  fclose(f);
+  return unreached;
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr, "usage: %s -f firmware.elf [-b budgets.txt] [-s seconds] [--bpm N] [--measure PCT]\n", argv0);
+}
+
+int main(int argc, char** argv) {
+  const char* firmware_path = NULL;
+  const char* budgets_path = NULL;
+  unsigned seconds = 120;
+  int measure_margin = -1;
+
+  for (int i = 1; i < argc; i++) {
+    int has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "-f") && has_value) {
+      firmware_path = argv[++i];
+    } else if (!strcmp(argv[i], "-b") && has_value) {
+      budgets_path = argv[++i];
+    } else if (!strcmp(argv[i], "-s") && has_value) {
+      seconds = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--bpm") && has_value) {
+      bpm = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--measure") && has_value) {
+      measure_margin = strtoul(argv[++i], NULL, 10);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (!firmware_path || !bpm || (measure_margin >= 0 && !budgets_path)) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (budgets_path && load_budgets(budgets_path)) return 2;
+  // a measuring run reports against no budgets, then writes new ones
+  if (measure_margin >= 0)
+    for (int id = 1; id < MARKER_COUNT; id++) markers[id].budget = 0;
+
+  elf_firmware_t firmware = {0};
+  if (elf_read_firmware(firmware_path, &firmware)) {
+    fprintf(stderr, "%s: unable to load firmware\n", firmware_path);
+    return 2;
+  }
+
+  avr = avr_make_mcu_by_name("atmega328p");
+  if (!avr) {
+    fprintf(stderr, "simavr has no atmega328p core\n");
+    return 2;
+  }
+  avr_init(avr);
+  avr->frequency = CPU_FREQUENCY;
+  avr->vcc = avr->avcc = avr->aref = 5000;
+  avr_load_firmware(avr, &firmware);
+
+  // keep the firmware's Serial debugging off our stdout
+  uint32_t uart_flags = 0;
+  avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &uart_flags);
+  uart_flags &= ~AVR_UART_FLAG_STDIO;
+  avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &uart_flags);
+
+  avr_register_io_write(avr, GPIOR0_ADDR, gpior_write, NULL);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(STROBE_PORT), STROBE_BIT), strobe_changed, NULL);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(RESET_PORT), RESET_BIT), reset_changed, NULL);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_OUT_TRIGGER), adc_triggered, NULL);
+
+  uint64_t end_cycle = (uint64_t)seconds * CPU_FREQUENCY;
+  while (avr->cycle < end_cycle) {
+    int state = avr_run(avr);
+    if (state == cpu_Done || state == cpu_Crashed) {
+      fprintf(stderr, "firmware stopped at cycle %llu (state %d)\n", (unsigned long long)avr->cycle, state);
+      return 1;
+    }
+  }
+
+  int over_budget = 0;
+  printf("%-16s %8s %10s %10s %10s %10s\n", "marker", "calls", "min", "mean", "max", "budget");
+  for (int id = 1; id < MARKER_COUNT; id++) {
+    marker_t* m = &markers[id];
+    char buf[16];
+    if (!m->count) {
+      if (m->budget) {
+        printf("%-16s %8u %10s %10s %10s %10llu  NOT REACHED\n", marker_name(id, buf, sizeof(buf)), 0u, "-", "-", "-",
+               (unsigned long long)m->budget);
+        over_budget = 1;
+      }
+      continue;
+    }
+
+    int over = m->budget && m->max > m->budget;
+    over_budget |= over;
+    printf("%-16s %8u %10llu %10.0f %10llu %10llu%s\n", marker_name(id, buf, sizeof(buf)), m->count,
+           (unsigned long long)m->min, (double)m->total / m->count, (unsigned long long)m->max,
+           (unsigned long long)m->budget, over ? "  OVER BUDGET" : "");
+  }
+
+  printf("\nMSGEQ7 sequencing: %lu frames, %lu violations\n", eq_frames, eq_violations);
+  int bad_sequencing = eq_violations > 0 || eq_frames == 0;
+
+  if (measure_margin >= 0) {
+    if (bad_sequencing) return 1;
+    int result = measure_budgets(budgets_path, seconds, measure_margin);
+    if (result >= 0) printf("%s rewritten from this run\n", budgets_path);
+    return result < 0 ? 2 : result;
+  }
+
+  return over_budget || bad_sequencing ? 1 : 0;
+}
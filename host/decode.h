@@ -0,0 +1,73 @@
+// Decoder for telemetry captured from a -DTELEMETRY_LEVEL build (see telemetry.h)
+//
+// Scans a raw Serial capture for valid records, skipping trace records and any
+// other interleaved bytes, and prints one line per record. Gaps in the sequence
+// are records the firmware dropped because its queue was full.
+
+#ifndef HOST_DECODE_H
+#define HOST_DECODE_H
+
+#include <vector>
+
+class TelemetryReader {
+  public:
+    uint32_t records = 0;      // valid records returned so far
+    uint32_t dropped = 0;      // sequence gaps
+    uint32_t skippedBytes = 0; // bytes that were not part of a valid record
+
+    bool open(const char* path) {
+      FILE* f = fopen(path, "rb");
+      if (!f) return false;
+      uint8_t chunk[4096];
+      size_t n;
+      while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+      }
+      fclose(f);
+      return true;
+    }
+
+    bool next(TelemetryRecord& record) {
+      while (pos + TELEMETRY_RECORD_SIZE <= data.size()) {
+        if (telemetryDecode(&data[pos], record)) {
+          pos += TELEMETRY_RECORD_SIZE;
+          if (records > 0) dropped += (uint8_t)(record.sequence - lastSequence - 1);
+          lastSequence = record.sequence;
+          records++;
+          return true;
+        }
+        pos++;
+        skippedBytes++;
+      }
+      return false;
+    }
+
+  private:
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+    uint8_t lastSequence = 0;
+};
+
+void printTelemetry(const TelemetryRecord& r, FILE* out) {
+  const uint8_t* p = r.payload;
+  switch (r.type) {
+    case TELEMETRY_STATUS:
+      fprintf(out, "%u status millisPerBeat=%u confidence=%u gain=%.2f kicks=%u snares=%u hats=%u\n", r.millis,
+              telemetryGet16(p, 0), p[2], telemetryGet16(p, 3) / 256.0, p[5], p[6], p[7]);
+      break;
+    case TELEMETRY_TIMING:
+      fprintf(out, "%u timing longestPassUs=%u meanPassUs=%u passes=%u audioTicks=%u dropped=%u\n", r.millis,
+              telemetryGet16(p, 0), telemetryGet16(p, 2), telemetryGet16(p, 4), p[6], p[7]);
+      break;
+    case TELEMETRY_ONSET:
+      fprintf(out, "%u onset flags=%c%c%c%c phase=%u beat=%u bass=%u overruns=%u\n", r.millis,
+              p[0] & ONSET_KICK ? 'K' : '-', p[0] & ONSET_SNARE ? 'S' : '-', p[0] & ONSET_HAT ? 'H' : '-',
+              p[0] & ONSET_ANY ? 'A' : '-', p[1], p[2], telemetryGet16(p, 3), telemetryGet16(p, 5));
+      break;
+    default:
+      fprintf(out, "%u type%u\n", r.millis, r.type);
+      break;
+  }
+}
+
+#endif
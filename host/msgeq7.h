@@ -0,0 +1,218 @@
+// MSGEQ7 model fed from a WAV file, for running real music through audio.h on the host
+//
+// Streams PCM (8/16/24/32-bit integer or 32-bit float, any channel count,
+// mixed to mono) through seven band-pass biquads at the MSGEQ7 centre
+// frequencies, each followed by a peak envelope detector. Outputs are in the
+// 0-1023 ADC counts doAnalogs() reads from ANALOGPIN, including the chip's DC
+// offset. The file is consumed lazily as the virtual clock advances, so memory
+// use doesn't depend on the length of the set.
+
+#ifndef HOST_MSGEQ7_H
+#define HOST_MSGEQ7_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+class Msgeq7Model {
+  public:
+    // 63 Hz to 16 kHz, one band per strobe after reset
+    static constexpr float CENTRE_HZ[7] = { 63, 160, 400, 1000, 2500, 6250, 16000 };
+    static constexpr float BAND_Q = 1.4f;           // roughly one octave wide
+    static constexpr float RELEASE_SECONDS = 0.01f;  // peak detector decay
+    static constexpr float OFFSET_COUNTS = 80;       // DC level with no signal
+    static constexpr float FULL_SCALE_COUNTS = 900;  // envelope of a 0 dBFS sine
+    // Decaying filter and envelope state is flushed to zero below this, before
+    // it turns denormal: denormal float math is about 100x slower, and digital
+    // silence between tracks would otherwise run entirely on it
+    static constexpr float DENORMAL_FLOOR = 1e-20f;
+
+    float gain = 1.0f; // input gain applied before the filter bank
+
+    ~Msgeq7Model() {
+      if (file) fclose(file);
+    }
+
+    // Returns false (with error set) for unreadable or unsupported files
+    bool open(const char* path) {
+      file = fopen(path, "rb");
+      if (!file) return fail("can't open file");
+
+      uint8_t riff[12];
+      if (fread(riff, 1, 12, file) != 12 || memcmp(riff, "RIFF", 4) || memcmp(riff + 8, "WAVE", 4)) {
+        return fail("not a RIFF/WAVE file");
+      }
+
+      bool haveFormat = false;
+      uint8_t chunk[8];
+      while (fread(chunk, 1, 8, file) == 8) {
+        uint32_t size = le32(chunk + 4);
+        if (!memcmp(chunk, "fmt ", 4)) {
+          uint8_t fmt[40] = {0};
+          if (size < 16 || fread(fmt, 1, size < sizeof(fmt) ? size : sizeof(fmt), file) < 16) {
+            return fail("short fmt chunk");
+          }
+          if (size > sizeof(fmt)) fseek(file, size - sizeof(fmt), SEEK_CUR);
+          format = le16(fmt);
+          channels = le16(fmt + 2);
+          sampleRate = le32(fmt + 4);
+          bitsPerSample = le16(fmt + 14);
+          if (format == 0xFFFE && size >= 26) format = le16(fmt + 24); // WAVE_FORMAT_EXTENSIBLE
+          haveFormat = true;
+        } else if (!memcmp(chunk, "data", 4)) {
+          dataRemaining = size;
+          break;
+        } else {
+          fseek(file, size + (size & 1), SEEK_CUR);
+        }
+      }
+
+      if (!haveFormat || !dataRemaining) return fail("missing fmt or data chunk");
+      if (!channels || !sampleRate) return fail("bad fmt chunk");
+      bool pcm = format == 1 && (bitsPerSample == 8 || bitsPerSample == 16 || bitsPerSample == 24 || bitsPerSample == 32);
+      bool ieeeFloat = format == 3 && bitsPerSample == 32;
+      if (!pcm && !ieeeFloat) return fail("unsupported sample format");
+
+      frameBytes = channels * (bitsPerSample / 8);
+      totalFrames = dataRemaining / frameBytes;
+      setupFilters();
+      return true;
+    }
+
+    // Run the filter bank up to the given time and return the band's output in ADC counts
+    uint16_t read(uint8_t band, uint64_t micros) {
+      advanceTo(micros);
+      float counts = OFFSET_COUNTS + envelope[band] * FULL_SCALE_COUNTS;
+      return counts > 1023 ? 1023 : (uint16_t)counts;
+    }
+
+    bool finished() const { return framesDone >= totalFrames; }
+    double durationSeconds() const { return sampleRate ? (double)totalFrames / sampleRate : 0; }
+    uint32_t rate() const { return sampleRate; }
+    const char* error = "";
+
+  private:
+    struct Biquad {
+      float b0, b2, a1, a2;  // band-pass has b1 = 0 and b2 = -b0
+      float x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+
+      float step(float x) {
+        float y = b0 * x + b2 * x2 - a1 * y1 - a2 * y2;
+        if (fabsf(y) < DENORMAL_FLOOR) y = 0;
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        y1 = y;
+        return y;
+      }
+    };
+
+    FILE* file = nullptr;
+    uint16_t format = 0;
+    uint16_t channels = 0;
+    uint32_t sampleRate = 0;
+    uint16_t bitsPerSample = 0;
+    uint32_t frameBytes = 0;
+    uint64_t dataRemaining = 0;
+    uint64_t totalFrames = 0;
+    uint64_t framesDone = 0;
+
+    Biquad filters[7];
+    float envelope[7] = {0};
+    float release = 0;
+
+    uint8_t buffer[1 << 16];
+    size_t bufferLength = 0;
+    size_t bufferPos = 0;
+
+    bool fail(const char* message) {
+      error = message;
+      return false;
+    }
+
+    static uint16_t le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+    static uint32_t le32(const uint8_t* p) { return le16(p) | ((uint32_t)le16(p + 2) << 16); }
+
+    // RBJ constant 0 dB peak gain band-pass, centre clamped below Nyquist
+    void setupFilters() {
+      for (uint8_t i = 0; i < 7; i++) {
+        float centre = CENTRE_HZ[i] < 0.45f * sampleRate ? CENTRE_HZ[i] : 0.45f * sampleRate;
+        float w0 = 2 * (float)M_PI * centre / sampleRate;
+        float alpha = sinf(w0) / (2 * BAND_Q);
+        float a0 = 1 + alpha;
+        filters[i].b0 = alpha / a0;
+        filters[i].b2 = -alpha / a0;
+        filters[i].a1 = -2 * cosf(w0) / a0;
+        filters[i].a2 = (1 - alpha) / a0;
+      }
+      release = expf(-1.0f / (RELEASE_SECONDS * sampleRate));
+    }
+
+    // Next frame mixed down to mono in -1..1, or false at end of data
+    bool nextFrame(float& mono) {
+      if (bufferPos + frameBytes > bufferLength) {
+        size_t keep = bufferLength - bufferPos;
+        memmove(buffer, buffer + bufferPos, keep);
+        size_t want = sizeof(buffer) - keep;
+        if (want > dataRemaining) want = dataRemaining;
+        size_t got = fread(buffer + keep, 1, want, file);
+        dataRemaining -= got;
+        bufferLength = keep + got;
+        bufferPos = 0;
+        if (bufferLength < frameBytes) return false;
+      }
+
+      const uint8_t* p = buffer + bufferPos;
+      bufferPos += frameBytes;
+
+      float sum = 0;
+      for (uint16_t c = 0; c < channels; c++) {
+        switch (bitsPerSample) {
+          case 8:
+            sum += (p[0] - 128) / 128.0f;
+            break;
+          case 16:
+            sum += (int16_t)le16(p) / 32768.0f;
+            break;
+          case 24:
+            sum += (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) / 2147483648.0f;
+            break;
+          case 32:
+            if (format == 3) {
+              float f;
+              memcpy(&f, p, 4);
+              sum += f;
+            } else {
+              sum += (int32_t)le32(p) / 2147483648.0f;
+            }
+            break;
+        }
+        p += bitsPerSample / 8;
+      }
+      mono = sum / channels;
+      return true;
+    }
+
+    void advanceTo(uint64_t micros) {
+      uint64_t target = micros * sampleRate / 1000000;
+      if (target > totalFrames) target = totalFrames;
+
+      while (framesDone < target) {
+        float x;
+        if (!nextFrame(x)) {
+          totalFrames = framesDone;
+          break;
+        }
+        x *= gain;
+        for (uint8_t i = 0; i < 7; i++) {
+          float y = fabsf(filters[i].step(x));
+          envelope[i] = y > envelope[i] ? y : envelope[i] * release;
+          if (envelope[i] < DENORMAL_FLOOR) envelope[i] = 0;
+        }
+        framesDone++;
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,77 @@
+// Reader for input traces recorded with -DTRACE_INPUT (see trace.h)
+//
+// Scans a raw Serial capture for valid records, skipping any interleaved
+// debug text, and counts records the firmware dropped under backpressure.
+// Traces from firmware that sends a header at boot also give the audio state it
+// restored from EEPROM; applyTraceHeader() puts the sketch in the same state.
+
+#ifndef HOST_REPLAY_H
+#define HOST_REPLAY_H
+
+#include <vector>
+
+class TraceReader {
+  public:
+    uint32_t records = 0;      // valid records returned so far
+    uint32_t dropped = 0;      // sequence gaps, i.e. records the firmware skipped
+    uint32_t skippedBytes = 0; // bytes that were not part of a valid record
+
+    bool open(const char* path) {
+      FILE* f = fopen(path, "rb");
+      if (!f) return false;
+      uint8_t chunk[4096];
+      size_t n;
+      while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+      }
+      fclose(f);
+      return true;
+    }
+
+    // The header, if one comes before the first record
+    bool header(TraceHeader& header) const {
+      for (size_t i = 0; i + TRACE_RECORD_SIZE <= data.size(); i++) {
+        if (traceDecodeHeader(&data[i], header)) return true;
+        TraceRecord record;
+        if (traceDecode(&data[i], record)) return false;
+      }
+      return false;
+    }
+
+    bool next(TraceRecord& record) {
+      TraceHeader header;
+      while (pos + TRACE_RECORD_SIZE <= data.size()) {
+        if (traceDecodeHeader(&data[pos], header)) {
+          pos += TRACE_RECORD_SIZE;
+          continue;
+        }
+        if (traceDecode(&data[pos], record)) {
+          pos += TRACE_RECORD_SIZE;
+          if (records > 0) dropped += (uint8_t)(record.sequence - lastSequence - 1);
+          lastSequence = record.sequence;
+          records++;
+          return true;
+        }
+        pos++;
+        skippedBytes++;
+      }
+      return false;
+    }
+
+  private:
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+    uint8_t lastSequence = 0;
+};
+
+// Replace the audio state setup() restored with the one the recording started from
+void applyTraceHeader(const TraceHeader& header) {
+  audioAvgQ16 = header.audioAvgQ16;
+  updateGainAGC();
+  memset(tempoHistogram, 0, sizeof(tempoHistogram));
+  millisPerBeat = 0;
+  tempoConfidence = 0;
+  seedTempo(header.millisPerBeat, header.tempoConfidence);
+}
+
+#endif
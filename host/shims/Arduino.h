@@ -0,0 +1,256 @@
+// Host stand-in for the Arduino core, just enough to build RaveShades.ino on Linux
+//
+// Time is virtual: millis()/micros() only move when the sketch blocks (delay(),
+// analogRead(), FastLED.show(), EEPROM writes, a full Serial TX buffer) or when
+// the simulator advances the clock between loop() passes. Pin, ADC and serial
+// state live in the host namespace so the simulator can script them.
+//
+// Known differences from the ATmega328: int is 32 bits here, so 16-bit
+// overflow in the sketch (e.g. uint16_t * uint16_t) does not wrap on the host.
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <type_traits>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEFAULT 1
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define memcpy_P memcpy
+#define F(str) (str)
+#define strcpy_P strcpy
+
+#define HOST_NUM_PINS 20
+
+namespace host {
+
+  // Virtual clock in microseconds since power-up
+  inline uint64_t clockMicros = 0;
+
+  inline void advanceMicros(uint32_t us) {
+    clockMicros += us;
+  }
+
+  // Pin levels as seen by digitalRead(); inputs idle HIGH like INPUT_PULLUP buttons
+  inline uint8_t pinLevel[HOST_NUM_PINS];
+  inline uint8_t pinModes[HOST_NUM_PINS];
+
+  // ADC conversion time at the default 125 kHz ADC clock (13 cycles)
+  const uint32_t ANALOG_READ_MICROS = 104;
+
+  // Called for every analogRead(); the simulator plugs its audio model in here
+  inline uint16_t (*analogSource)(uint8_t pin) = nullptr;
+
+  // Called for every digitalWrite() after the level has been latched
+  inline void (*digitalWriteHook)(uint8_t pin, uint8_t val) = nullptr;
+
+  inline void resetPins() {
+    for (uint8_t i = 0; i < HOST_NUM_PINS; i++) {
+      pinLevel[i] = HIGH;
+      pinModes[i] = INPUT;
+    }
+  }
+
+} // namespace host
+
+inline uint32_t millis() {
+  return (uint32_t)(host::clockMicros / 1000);
+}
+
+inline uint32_t micros() {
+  return (uint32_t)host::clockMicros;
+}
+
+inline void delay(uint32_t ms) {
+  host::advanceMicros(ms * 1000);
+}
+
+inline void delayMicroseconds(unsigned int us) {
+  host::advanceMicros(us);
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin >= HOST_NUM_PINS) return;
+  host::pinModes[pin] = mode;
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin >= HOST_NUM_PINS) return;
+  host::pinLevel[pin] = val ? HIGH : LOW;
+  if (host::digitalWriteHook) host::digitalWriteHook(pin, host::pinLevel[pin]);
+}
+
+inline int digitalRead(uint8_t pin) {
+  if (pin >= HOST_NUM_PINS) return LOW;
+  return host::pinLevel[pin];
+}
+
+inline int analogRead(uint8_t pin) {
+  host::advanceMicros(host::ANALOG_READ_MICROS);
+  if (!host::analogSource) return 0;
+  uint16_t value = host::analogSource(pin);
+  return value > 1023 ? 1023 : value;
+}
+
+inline void analogReference(uint8_t mode) {
+  (void)mode;
+}
+
+// Simulated interrupts only run between loop() passes, so there is nothing to mask
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// AVR's software divide does not trap on a zero range, so don't raise SIGFPE here
+inline long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  if (in_max == in_min) return out_min;
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+inline long random(long howbig) {
+  if (howbig == 0) return 0;
+  return ::random() % howbig;
+}
+
+inline long random(long howsmall, long howbig) {
+  if (howsmall >= howbig) return howsmall;
+  return random(howbig - howsmall) + howsmall;
+}
+
+// HardwareSerial with a modelled 64-byte TX ring at the configured baud rate.
+// Writes block (advance the virtual clock) once the ring is full, like the AVR core.
+class HardwareSerial {
+  public:
+    static const uint8_t TX_BUFFER_SIZE = 64;
+
+    FILE* sink = nullptr;  // where transmitted bytes end up; nullptr discards them
+
+    void begin(unsigned long baud) {
+      byteMicros = baud ? 10000000.0 / baud : 0;
+      queued = 0;
+      lastDrainMicros = host::clockMicros;
+    }
+
+    void end() {}
+
+    int availableForWrite() {
+      drain();
+      return TX_BUFFER_SIZE - 1 - (int)ceil(queued);
+    }
+
+    void flush() {
+      drain();
+      host::advanceMicros((uint32_t)ceil(queued * byteMicros));
+      drain();
+    }
+
+    size_t write(uint8_t c) {
+      drain();
+      if (queued >= TX_BUFFER_SIZE - 1) {
+        // wait for the UDRE interrupt to free a slot
+        host::advanceMicros((uint32_t)ceil((queued - (TX_BUFFER_SIZE - 2)) * byteMicros));
+        drain();
+      }
+      if (byteMicros > 0) queued += 1;
+      if (sink) fputc(c, sink);
+      return 1;
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) {
+      for (size_t i = 0; i < size; i++) write(buffer[i]);
+      return size;
+    }
+
+    size_t print(const char* str) {
+      return write((const uint8_t*)str, strlen(str));
+    }
+
+    size_t print(char c) {
+      return write((uint8_t)c);
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value, size_t>::type print(T value, int base = DEC) {
+      char buf[8 * sizeof(T) + 2];
+      if (base == HEX) {
+        snprintf(buf, sizeof(buf), "%llX", (unsigned long long)value);
+      } else if (std::is_signed<T>::value) {
+        snprintf(buf, sizeof(buf), "%lld", (long long)value);
+      } else {
+        snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+      }
+      return print(buf);
+    }
+
+    size_t print(double value, int digits = 2) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%.*f", digits, value);
+      return print(buf);
+    }
+
+    size_t println() {
+      return print("\r\n");
+    }
+
+    template <typename T>
+    size_t println(T value) {
+      size_t n = print(value);
+      return n + println();
+    }
+
+    // Received bytes, queued by the simulator with receive()
+    int available() { return rxLength - rxPos; }
+    int read() { return rxPos < rxLength ? rxBuffer[rxPos++] : -1; }
+
+    void receive(const char* text) {
+      if (rxPos == rxLength) rxPos = rxLength = 0;
+      while (*text && rxLength < sizeof(rxBuffer)) rxBuffer[rxLength++] = *text++;
+    }
+
+  private:
+    uint8_t rxBuffer[64];
+    size_t rxLength = 0;
+    size_t rxPos = 0;
+    double byteMicros = 0;       // time to shift out one 8N1 frame
+    double queued = 0;           // bytes still waiting in the TX ring
+    uint64_t lastDrainMicros = 0;
+
+    void drain() {
+      if (byteMicros <= 0) return;
+      double sent = (host::clockMicros - lastDrainMicros) / byteMicros;
+      lastDrainMicros = host::clockMicros;
+      queued = sent >= queued ? 0 : queued - sent;
+    }
+};
+
+inline HardwareSerial Serial;
+
+#endif
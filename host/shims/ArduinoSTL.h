@@ -0,0 +1,9 @@
+// Host stand-in for ArduinoSTL: the real standard library is already here
+
+#ifndef HOST_ARDUINOSTL_H
+#define HOST_ARDUINOSTL_H
+
+#include <algorithm>
+#include <vector>
+
+#endif
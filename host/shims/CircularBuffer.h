@@ -0,0 +1,69 @@
+// Host stand-in for the rlogiacco CircularBuffer library (1.3.x API)
+
+#ifndef HOST_CIRCULARBUFFER_H
+#define HOST_CIRCULARBUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+
+template <typename T, size_t S,
+          typename IT = typename std::conditional<(S <= UINT8_MAX), uint8_t,
+                        typename std::conditional<(S <= UINT16_MAX), uint16_t, uint32_t>::type>::type>
+class CircularBuffer {
+  public:
+    typedef IT index_t;
+
+    // Adds an element to the end, dropping the oldest one when full.
+    // Returns false when an element was overwritten.
+    bool push(T value) {
+      if (count == S) {
+        head = (head + 1) % S;
+        buffer[(head + count - 1) % S] = value;
+        return false;
+      }
+      buffer[(head + count) % S] = value;
+      count++;
+      return true;
+    }
+
+    // Adds an element to the beginning, dropping the newest one when full
+    bool unshift(T value) {
+      head = (head + S - 1) % S;
+      buffer[head] = value;
+      if (count == S) return false;
+      count++;
+      return true;
+    }
+
+    T shift() {
+      T result = buffer[head];
+      head = (head + 1) % S;
+      count--;
+      return result;
+    }
+
+    T pop() {
+      count--;
+      return buffer[(head + count) % S];
+    }
+
+    T first() const { return buffer[head]; }
+    T last() const { return buffer[(head + count - 1) % S]; }
+
+    T operator[](IT index) const { return buffer[(head + index) % S]; }
+
+    IT size() const { return count; }
+    IT available() const { return S - count; }
+    IT capacity() const { return S; }
+    bool isEmpty() const { return count == 0; }
+    bool isFull() const { return count == S; }
+    void clear() { head = 0; count = 0; }
+
+  private:
+    T buffer[S];
+    IT head = 0;
+    IT count = 0;
+};
+
+#endif
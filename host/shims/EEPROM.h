@@ -0,0 +1,72 @@
+// Host stand-in for the Arduino EEPROM library: 1 KB of erased (0xFF) cells.
+// Like the ATmega328, a write starts a ~3.3 ms erase/write cycle that runs in
+// the background; the next access waits on the virtual clock until it is done,
+// as eeprom_write_byte() and eeprom_read_byte() do, and eeprom_is_ready() says
+// whether it is.
+
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include <Arduino.h>
+
+namespace host {
+
+  const uint16_t EEPROM_SIZE = 1024;
+  const uint32_t EEPROM_WRITE_MICROS = 3300;
+
+  inline uint8_t eeprom[EEPROM_SIZE];
+  inline uint32_t eepromWrites[EEPROM_SIZE]; // per-cell write counts, for wear checks
+  inline uint64_t eepromReadyMicros = 0; // end of the write cycle in progress
+
+  inline void waitEEPROM() {
+    if (clockMicros < eepromReadyMicros) clockMicros = eepromReadyMicros;
+  }
+
+  inline void eraseEEPROM() {
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    memset(eepromWrites, 0, sizeof(eepromWrites));
+  }
+
+} // namespace host
+
+class EEPROMClass {
+  public:
+    uint8_t read(int idx) {
+      host::waitEEPROM();
+      return host::eeprom[idx % host::EEPROM_SIZE];
+    }
+
+    void write(int idx, uint8_t val) {
+      idx %= host::EEPROM_SIZE;
+      host::waitEEPROM();
+      host::eepromReadyMicros = host::clockMicros + host::EEPROM_WRITE_MICROS;
+      host::eeprom[idx] = val;
+      host::eepromWrites[idx]++;
+    }
+
+    void update(int idx, uint8_t val) {
+      if (read(idx) != val) write(idx, val);
+    }
+
+    uint16_t length() { return host::EEPROM_SIZE; }
+
+    template <typename T> T& get(int idx, T& t) {
+      uint8_t* ptr = (uint8_t*)&t;
+      for (size_t i = 0; i < sizeof(T); i++) ptr[i] = read(idx + i);
+      return t;
+    }
+
+    template <typename T> const T& put(int idx, const T& t) {
+      const uint8_t* ptr = (const uint8_t*)&t;
+      for (size_t i = 0; i < sizeof(T); i++) update(idx + i, ptr[i]);
+      return t;
+    }
+};
+
+inline EEPROMClass EEPROM;
+
+inline bool eeprom_is_ready() {
+  return host::clockMicros >= host::eepromReadyMicros;
+}
+
+#endif
@@ -0,0 +1,721 @@
+// Host stand-in for the parts of FastLED 3.x used by RaveShades
+//
+// The 8-bit math, HSV conversion, palette and random number code follow
+// FastLED's portable C implementations, so colours and random8() sequences
+// match the device. show() hands the first controller's pixels to
+// host::showHook and charges the WS2811 transmit time to the virtual clock.
+// inoise8() is a cheap value noise, not FastLED's Perlin noise.
+
+#ifndef HOST_FASTLED_H
+#define HOST_FASTLED_H
+
+#include <Arduino.h>
+
+typedef uint8_t fract8;
+typedef uint16_t accum88;
+typedef int16_t saccum87;
+
+///////////////////////////////////////////////////////////////////////////////
+// lib8tion
+
+inline uint8_t qadd8(uint8_t i, uint8_t j) {
+  unsigned int t = i + j;
+  return t > 255 ? 255 : t;
+}
+
+inline uint8_t qsub8(uint8_t i, uint8_t j) {
+  int t = i - j;
+  return t < 0 ? 0 : t;
+}
+
+inline uint8_t qmul8(uint8_t i, uint8_t j) {
+  unsigned int p = (unsigned int)i * (unsigned int)j;
+  return p > 255 ? 255 : p;
+}
+
+inline uint8_t scale8(uint8_t i, fract8 scale) {
+  return (((uint16_t)i) * (1 + (uint16_t)scale)) >> 8;
+}
+
+inline uint8_t scale8_video(uint8_t i, fract8 scale) {
+  return (((int)i * (int)scale) >> 8) + ((i && scale) ? 1 : 0);
+}
+
+inline uint16_t scale16by8(uint16_t i, fract8 scale) {
+  return (i * (1 + ((uint16_t)scale))) >> 8;
+}
+
+inline uint8_t lerp8by8(uint8_t a, uint8_t b, fract8 frac) {
+  if (b > a) {
+    return a + scale8(b - a, frac);
+  }
+  return a - scale8(a - b, frac);
+}
+
+inline uint8_t blend8(uint8_t a, uint8_t b, uint8_t amountOfB) {
+  uint16_t partial = (a << 8) | b;
+  partial += (b * amountOfB);
+  partial -= (a * amountOfB);
+  return partial >> 8;
+}
+
+inline uint8_t triwave8(uint8_t in) {
+  if (in & 0x80) {
+    in = 255 - in;
+  }
+  return in << 1;
+}
+
+inline uint8_t ease8InOutQuad(uint8_t i) {
+  uint8_t j = i;
+  if (j & 0x80) {
+    j = 255 - j;
+  }
+  uint8_t jj = scale8(j, j);
+  uint8_t jj2 = jj << 1;
+  if (i & 0x80) {
+    jj2 = 255 - jj2;
+  }
+  return jj2;
+}
+
+inline uint8_t sin8(uint8_t theta) {
+  static const uint8_t b_m16_interleave[] = { 0, 49, 49, 41, 90, 27, 117, 10 };
+
+  uint8_t offset = theta;
+  if (theta & 0x40) {
+    offset = (uint8_t)255 - offset;
+  }
+  offset &= 0x3F; // 0..63
+
+  uint8_t secoffset = offset & 0x0F; // 0..15
+  if (theta & 0x40) secoffset++;
+
+  uint8_t section = offset >> 4; // 0..3
+  uint8_t b = b_m16_interleave[section * 2];
+  uint8_t m16 = b_m16_interleave[section * 2 + 1];
+
+  uint8_t mx = (m16 * secoffset) >> 4;
+
+  int8_t y = mx + b;
+  if (theta & 0x80) y = -y;
+
+  y += 128;
+
+  return y;
+}
+
+inline uint8_t cos8(uint8_t theta) {
+  return sin8(theta + 64);
+}
+
+inline int16_t sin16(uint16_t theta) {
+  static const uint16_t base[] = { 0, 6393, 12539, 18204, 23170, 27245, 30273, 32137 };
+  static const uint8_t slope[] = { 49, 48, 44, 38, 31, 23, 14, 4 };
+
+  uint16_t offset = (theta & 0x3FFF) >> 3; // 0..2047
+  if (theta & 0x4000) offset = 2047 - offset;
+
+  uint8_t section = offset / 256; // 0..7
+  uint16_t b = base[section];
+  uint8_t m = slope[section];
+
+  uint8_t secoffset8 = (uint8_t)(offset) / 2;
+
+  uint16_t mx = m * secoffset8;
+  int16_t y = mx + b;
+
+  if (theta & 0x8000) y = -y;
+
+  return y;
+}
+
+inline int16_t cos16(uint16_t theta) {
+  return sin16(theta + 16384);
+}
+
+inline uint8_t quadwave8(uint8_t in) {
+  return ease8InOutQuad(triwave8(in));
+}
+
+// 16-bit LCG shared by random8()/random16(), seeded like FastLED
+inline uint16_t rand16seed = 1337;
+
+#define FASTLED_RAND16_2053 ((uint16_t)(2053))
+#define FASTLED_RAND16_13849 ((uint16_t)(13849))
+
+inline uint8_t random8() {
+  rand16seed = (rand16seed * FASTLED_RAND16_2053) + FASTLED_RAND16_13849;
+  // return the sum of the high and low bytes, for better mixing
+  return (uint8_t)(((uint8_t)(rand16seed & 0xFF)) + ((uint8_t)(rand16seed >> 8)));
+}
+
+inline uint8_t random8(uint8_t lim) {
+  uint8_t r = random8();
+  r = (r * lim) >> 8;
+  return r;
+}
+
+inline uint8_t random8(uint8_t min, uint8_t lim) {
+  uint8_t delta = lim - min;
+  return random8(delta) + min;
+}
+
+inline uint16_t random16() {
+  rand16seed = (rand16seed * FASTLED_RAND16_2053) + FASTLED_RAND16_13849;
+  return rand16seed;
+}
+
+inline uint16_t random16(uint16_t lim) {
+  uint16_t r = random16();
+  uint32_t p = (uint32_t)lim * (uint32_t)r;
+  return p >> 16;
+}
+
+inline uint16_t random16(uint16_t min, uint16_t lim) {
+  uint16_t delta = lim - min;
+  return random16(delta) + min;
+}
+
+inline void random16_set_seed(uint16_t seed) {
+  rand16seed = seed;
+}
+
+inline uint16_t random16_get_seed() {
+  return rand16seed;
+}
+
+inline void random16_add_entropy(uint16_t entropy) {
+  rand16seed += entropy;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pixel types
+
+struct CHSV {
+  union {
+    struct {
+      union { uint8_t hue; uint8_t h; };
+      union { uint8_t saturation; uint8_t sat; uint8_t s; };
+      union { uint8_t value; uint8_t val; uint8_t v; };
+    };
+    uint8_t raw[3];
+  };
+
+  CHSV() {}
+  CHSV(uint8_t ih, uint8_t is, uint8_t iv) : h(ih), s(is), v(iv) {}
+};
+
+struct CRGB;
+void hsv2rgb_rainbow(const CHSV& hsv, CRGB& rgb);
+
+struct CRGB {
+  union {
+    struct {
+      union { uint8_t r; uint8_t red; };
+      union { uint8_t g; uint8_t green; };
+      union { uint8_t b; uint8_t blue; };
+    };
+    uint8_t raw[3];
+  };
+
+  typedef enum {
+    Black = 0x000000,
+    Blue = 0x0000FF,
+    BlueViolet = 0x8A2BE2,
+    Cyan = 0x00FFFF,
+    DarkBlue = 0x00008B,
+    DarkGreen = 0x006400,
+    DarkOrange = 0xFF8C00,
+    DarkRed = 0x8B0000,
+    DeepPink = 0xFF1493,
+    Fuchsia = 0xFF00FF,
+    Gold = 0xFFD700,
+    Gray = 0x808080,
+    Green = 0x008000,
+    HotPink = 0xFF69B4,
+    LightCoral = 0xF08080,
+    LightSeaGreen = 0x20B2AA,
+    LightSkyBlue = 0x87CEFA,
+    Magenta = 0xFF00FF,
+    MediumVioletRed = 0xC71585,
+    Orange = 0xFFA500,
+    OrangeRed = 0xFF4500,
+    Purple = 0x800080,
+    Red = 0xFF0000,
+    Salmon = 0xFA8072,
+    Violet = 0xEE82EE,
+    White = 0xFFFFFF,
+    Yellow = 0xFFFF00
+  } HTMLColorCode;
+
+  CRGB() {}
+  CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+  CRGB(uint32_t colorcode) : r((colorcode >> 16) & 0xFF), g((colorcode >> 8) & 0xFF), b(colorcode & 0xFF) {}
+  CRGB(HTMLColorCode colorcode) : CRGB((uint32_t)colorcode) {}
+  CRGB(const CHSV& rhs) { hsv2rgb_rainbow(rhs, *this); }
+
+  CRGB& operator=(const CHSV& rhs) {
+    hsv2rgb_rainbow(rhs, *this);
+    return *this;
+  }
+
+  uint8_t& operator[](uint8_t x) { return raw[x]; }
+  const uint8_t& operator[](uint8_t x) const { return raw[x]; }
+
+  CRGB& operator+=(const CRGB& rhs) {
+    r = qadd8(r, rhs.r);
+    g = qadd8(g, rhs.g);
+    b = qadd8(b, rhs.b);
+    return *this;
+  }
+
+  CRGB& operator-=(const CRGB& rhs) {
+    r = qsub8(r, rhs.r);
+    g = qsub8(g, rhs.g);
+    b = qsub8(b, rhs.b);
+    return *this;
+  }
+
+  CRGB& nscale8(uint8_t scaledown) {
+    uint16_t scale_fixed = scaledown + 1;
+    r = (((uint16_t)r) * scale_fixed) >> 8;
+    g = (((uint16_t)g) * scale_fixed) >> 8;
+    b = (((uint16_t)b) * scale_fixed) >> 8;
+    return *this;
+  }
+
+  CRGB& nscale8_video(uint8_t scaledown) {
+    r = scale8_video(r, scaledown);
+    g = scale8_video(g, scaledown);
+    b = scale8_video(b, scaledown);
+    return *this;
+  }
+
+  CRGB& fadeToBlackBy(uint8_t fadefactor) {
+    return nscale8(255 - fadefactor);
+  }
+
+  CRGB& setRGB(uint8_t nr, uint8_t ng, uint8_t nb) {
+    r = nr;
+    g = ng;
+    b = nb;
+    return *this;
+  }
+
+  CRGB& setHSV(uint8_t hue, uint8_t sat, uint8_t val) {
+    hsv2rgb_rainbow(CHSV(hue, sat, val), *this);
+    return *this;
+  }
+
+  uint8_t getAverageLight() const {
+    return scale8(r, 85) + scale8(g, 85) + scale8(b, 85);
+  }
+
+  explicit operator bool() const { return r || g || b; }
+};
+
+inline bool operator==(const CRGB& lhs, const CRGB& rhs) {
+  return (lhs.r == rhs.r) && (lhs.g == rhs.g) && (lhs.b == rhs.b);
+}
+
+inline bool operator!=(const CRGB& lhs, const CRGB& rhs) {
+  return !(lhs == rhs);
+}
+
+inline CRGB operator+(const CRGB& p1, const CRGB& p2) {
+  return CRGB(qadd8(p1.r, p2.r), qadd8(p1.g, p2.g), qadd8(p1.b, p2.b));
+}
+
+inline void hsv2rgb_rainbow(const CHSV& hsv, CRGB& rgb) {
+  uint8_t hue = hsv.hue;
+  uint8_t sat = hsv.sat;
+  uint8_t val = hsv.val;
+
+  uint8_t offset = hue & 0x1F; // 0..31
+  uint8_t offset8 = offset << 3;
+  uint8_t third = scale8(offset8, (256 / 3)); // max = 85
+
+  uint8_t r, g, b;
+
+  if (!(hue & 0x80)) {
+    if (!(hue & 0x40)) {
+      if (!(hue & 0x20)) {
+        // 000 R -> O
+        r = 255 - third; g = third; b = 0;
+      } else {
+        // 001 O -> Y
+        r = 171; g = 85 + third; b = 0;
+      }
+    } else {
+      if (!(hue & 0x20)) {
+        // 010 Y -> G
+        uint8_t twothirds = scale8(offset8, ((256 * 2) / 3)); // max=170
+        r = 171 - twothirds; g = 170 + third; b = 0;
+      } else {
+        // 011 G -> A
+        r = 0; g = 255 - third; b = third;
+      }
+    }
+  } else {
+    if (!(hue & 0x40)) {
+      if (!(hue & 0x20)) {
+        // 100 A -> B
+        uint8_t twothirds = scale8(offset8, ((256 * 2) / 3)); // max=170
+        r = 0; g = 171 - twothirds; b = 85 + twothirds;
+      } else {
+        // 101 B -> P
+        r = third; g = 0; b = 255 - third;
+      }
+    } else {
+      if (!(hue & 0x20)) {
+        // 110 P -- K
+        r = 85 + third; g = 0; b = 171 - third;
+      } else {
+        // 111 K -> R
+        r = 170 + third; g = 0; b = 85 - third;
+      }
+    }
+  }
+
+  // Scale down colors if we're desaturated at all
+  // and add the brightness_floor to r, g, and b.
+  if (sat != 255) {
+    if (sat == 0) {
+      r = 255; b = 255; g = 255;
+    } else {
+      uint8_t desat = 255 - sat;
+      desat = scale8_video(desat, desat);
+
+      uint8_t satscale = 255 - desat;
+
+      r = scale8(r, satscale) + desat;
+      g = scale8(g, satscale) + desat;
+      b = scale8(b, satscale) + desat;
+    }
+  }
+
+  // Now scale everything down if we're at value < 255.
+  if (val != 255) {
+    val = scale8_video(val, val);
+    if (val == 0) {
+      r = 0; g = 0; b = 0;
+    } else {
+      r = scale8(r, val);
+      g = scale8(g, val);
+      b = scale8(b, val);
+    }
+  }
+
+  rgb.r = r;
+  rgb.g = g;
+  rgb.b = b;
+}
+
+inline CRGB& nblend(CRGB& existing, const CRGB& overlay, fract8 amountOfOverlay) {
+  if (amountOfOverlay == 0) {
+    return existing;
+  }
+
+  if (amountOfOverlay == 255) {
+    existing = overlay;
+    return existing;
+  }
+
+  existing.red = blend8(existing.red, overlay.red, amountOfOverlay);
+  existing.green = blend8(existing.green, overlay.green, amountOfOverlay);
+  existing.blue = blend8(existing.blue, overlay.blue, amountOfOverlay);
+
+  return existing;
+}
+
+inline CRGB blend(const CRGB& p1, const CRGB& p2, fract8 amountOfP2) {
+  CRGB nu(p1);
+  nblend(nu, p2, amountOfP2);
+  return nu;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Palettes
+
+typedef uint32_t TProgmemRGBPalette16[16];
+
+typedef enum { NOBLEND = 0, LINEARBLEND = 1 } TBlendType;
+
+inline void fill_solid(CRGB* leds, int numToFill, const CRGB& color) {
+  for (int i = 0; i < numToFill; i++) leds[i] = color;
+}
+
+inline void fill_gradient_RGB(CRGB* leds, uint16_t startpos, CRGB startcolor, uint16_t endpos, CRGB endcolor) {
+  // if the points are in the wrong order, straighten them
+  if (endpos < startpos) {
+    uint16_t t = endpos;
+    CRGB tc = endcolor;
+    endcolor = startcolor;
+    endpos = startpos;
+    startpos = t;
+    startcolor = tc;
+  }
+
+  saccum87 rdistance87 = (endcolor.r - startcolor.r) << 7;
+  saccum87 gdistance87 = (endcolor.g - startcolor.g) << 7;
+  saccum87 bdistance87 = (endcolor.b - startcolor.b) << 7;
+
+  uint16_t pixeldistance = endpos - startpos;
+  int16_t divisor = pixeldistance ? pixeldistance : 1;
+
+  saccum87 rdelta87 = rdistance87 / divisor;
+  saccum87 gdelta87 = gdistance87 / divisor;
+  saccum87 bdelta87 = bdistance87 / divisor;
+
+  rdelta87 *= 2;
+  gdelta87 *= 2;
+  bdelta87 *= 2;
+
+  accum88 r88 = startcolor.r << 8;
+  accum88 g88 = startcolor.g << 8;
+  accum88 b88 = startcolor.b << 8;
+  for (uint16_t i = startpos; i <= endpos; ++i) {
+    leds[i] = CRGB(r88 >> 8, g88 >> 8, b88 >> 8);
+    r88 += rdelta87;
+    g88 += gdelta87;
+    b88 += bdelta87;
+  }
+}
+
+inline void fill_gradient_RGB(CRGB* leds, uint16_t numLeds, const CRGB& c1, const CRGB& c2) {
+  uint16_t last = numLeds - 1;
+  fill_gradient_RGB(leds, 0, c1, last, c2);
+}
+
+inline void fill_gradient_RGB(CRGB* leds, uint16_t numLeds, const CRGB& c1, const CRGB& c2, const CRGB& c3) {
+  uint16_t half = (numLeds / 2);
+  uint16_t last = numLeds - 1;
+  fill_gradient_RGB(leds, 0, c1, half, c2);
+  fill_gradient_RGB(leds, half, c2, last, c3);
+}
+
+inline void fill_gradient_RGB(CRGB* leds, uint16_t numLeds, const CRGB& c1, const CRGB& c2, const CRGB& c3, const CRGB& c4) {
+  uint16_t onethird = (numLeds / 3);
+  uint16_t twothirds = ((numLeds * 2) / 3);
+  uint16_t last = numLeds - 1;
+  fill_gradient_RGB(leds, 0, c1, onethird, c2);
+  fill_gradient_RGB(leds, onethird, c2, twothirds, c3);
+  fill_gradient_RGB(leds, twothirds, c3, last, c4);
+}
+
+class CRGBPalette16 {
+  public:
+    CRGB entries[16];
+
+    CRGBPalette16() {}
+
+    CRGBPalette16(const TProgmemRGBPalette16& rhs) {
+      for (uint8_t i = 0; i < 16; i++) {
+        entries[i] = CRGB(rhs[i]);
+      }
+    }
+
+    CRGBPalette16& operator=(const TProgmemRGBPalette16& rhs) {
+      for (uint8_t i = 0; i < 16; i++) {
+        entries[i] = CRGB(rhs[i]);
+      }
+      return *this;
+    }
+
+    CRGBPalette16(const CRGB& c1) {
+      for (uint8_t i = 0; i < 16; i++) entries[i] = c1;
+    }
+
+    CRGBPalette16(const CRGB& c1, const CRGB& c2) {
+      fill_gradient_RGB(entries, 16, c1, c2);
+    }
+
+    CRGBPalette16(const CRGB& c1, const CRGB& c2, const CRGB& c3) {
+      fill_gradient_RGB(entries, 16, c1, c2, c3);
+    }
+
+    CRGBPalette16(const CRGB& c1, const CRGB& c2, const CRGB& c3, const CRGB& c4) {
+      fill_gradient_RGB(entries, 16, c1, c2, c3, c4);
+    }
+
+    bool operator==(const CRGBPalette16& rhs) const {
+      return memcmp(entries, rhs.entries, sizeof(entries)) == 0;
+    }
+
+    bool operator!=(const CRGBPalette16& rhs) const {
+      return !(*this == rhs);
+    }
+
+    CRGB& operator[](uint8_t x) { return entries[x]; }
+    const CRGB& operator[](uint8_t x) const { return entries[x]; }
+};
+
+inline const TProgmemRGBPalette16 RainbowColors_p = {
+  0xFF0000, 0xD52A00, 0xAB5500, 0xAB7F00,
+  0xABAB00, 0x56D500, 0x00FF00, 0x00D52A,
+  0x00AB55, 0x0056AA, 0x0000FF, 0x2A00D5,
+  0x5500AB, 0x7F0081, 0xAB0055, 0xD5002B
+};
+
+inline const TProgmemRGBPalette16 PartyColors_p = {
+  0x5500AB, 0x84007C, 0xB5004B, 0xE5001B,
+  0xE81700, 0xB84700, 0xAB7700, 0xABAB00,
+  0xAB5500, 0xDD2200, 0xF2000E, 0xC2003E,
+  0x8F0071, 0x5F00A1, 0x2F00D0, 0x0007F9
+};
+
+inline const TProgmemRGBPalette16 HeatColors_p = {
+  0x000000, 0x330000, 0x660000, 0x990000,
+  0xCC0000, 0xFF0000, 0xFF3300, 0xFF6600,
+  0xFF9900, 0xFFCC00, 0xFFFF00, 0xFFFF33,
+  0xFFFF66, 0xFFFF99, 0xFFFFCC, 0xFFFFFF
+};
+
+inline CRGB ColorFromPalette(const CRGBPalette16& pal, uint8_t index, uint8_t brightness = 255, TBlendType blendType = LINEARBLEND) {
+  uint8_t hi4 = index >> 4;
+  uint8_t lo4 = index & 0x0F;
+
+  const CRGB* entry = &(pal[0]) + hi4;
+  uint8_t blend = lo4 && (blendType != NOBLEND);
+
+  uint8_t red1 = entry->red;
+  uint8_t green1 = entry->green;
+  uint8_t blue1 = entry->blue;
+
+  if (blend) {
+    if (hi4 == 15) {
+      entry = &(pal[0]);
+    } else {
+      ++entry;
+    }
+
+    uint8_t f2 = lo4 << 4;
+    uint8_t f1 = 255 - f2;
+
+    red1 = scale8(red1, f1) + scale8(entry->red, f2);
+    green1 = scale8(green1, f1) + scale8(entry->green, f2);
+    blue1 = scale8(blue1, f1) + scale8(entry->blue, f2);
+  }
+
+  if (brightness != 255) {
+    if (brightness) {
+      ++brightness; // adjust for rounding
+      if (red1) red1 = scale8(red1, brightness);
+      if (green1) green1 = scale8(green1, brightness);
+      if (blue1) blue1 = scale8(blue1, brightness);
+    } else {
+      red1 = 0;
+      green1 = 0;
+      blue1 = 0;
+    }
+  }
+
+  return CRGB(red1, green1, blue1);
+}
+
+inline void nblendPaletteTowardPalette(CRGBPalette16& current, CRGBPalette16& target, uint8_t maxChanges) {
+  uint8_t* p1 = (uint8_t*)current.entries;
+  uint8_t* p2 = (uint8_t*)target.entries;
+
+  const uint8_t totalChannels = sizeof(CRGBPalette16);
+  uint8_t changes = 0;
+  for (uint8_t i = 0; i < totalChannels; ++i) {
+    // if the values are equal, no changes are needed
+    if (p1[i] == p2[i]) { continue; }
+
+    // if the current value is less than the target, increase it by one
+    if (p1[i] < p2[i]) { ++p1[i]; ++changes; }
+
+    // if the current value is greater than the target,
+    // increase it by one (or two if it's still greater).
+    if (p1[i] > p2[i]) {
+      --p1[i]; ++changes;
+      if (p1[i] > p2[i]) { --p1[i]; }
+    }
+
+    // if we've hit the maximum number of changes, exit
+    if (changes >= maxChanges) { break; }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Noise
+
+inline uint8_t hostNoiseLattice(int32_t x, int32_t y, int32_t z) {
+  uint32_t h = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u + (uint32_t)z * 2147483647u;
+  h = (h ^ (h >> 13)) * 1274126177u;
+  return (h ^ (h >> 16)) & 0xFF;
+}
+
+// Trilinear value noise over a 256-unit lattice, same argument scale as inoise8
+inline uint8_t inoise8(uint16_t x, uint16_t y, uint16_t z) {
+  int32_t xi = x >> 8, yi = y >> 8, zi = z >> 8;
+  uint8_t xf = ease8InOutQuad(x & 0xFF), yf = ease8InOutQuad(y & 0xFF), zf = ease8InOutQuad(z & 0xFF);
+
+  uint8_t c[2][2];
+  for (uint8_t dz = 0; dz < 2; dz++) {
+    for (uint8_t dy = 0; dy < 2; dy++) {
+      c[dz][dy] = lerp8by8(hostNoiseLattice(xi, yi + dy, zi + dz), hostNoiseLattice(xi + 1, yi + dy, zi + dz), xf);
+    }
+  }
+  return lerp8by8(lerp8by8(c[0][0], c[0][1], yf), lerp8by8(c[1][0], c[1][1], yf), zf);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Controller
+
+typedef enum { RGB = 0012, RBG = 0021, GRB = 0102, GBR = 0120, BRG = 0201, BGR = 0210 } EOrder;
+
+template <uint8_t DATA_PIN, EOrder RGB_ORDER> class WS2811 {};
+template <uint8_t DATA_PIN, EOrder RGB_ORDER> class WS2812B {};
+template <uint8_t DATA_PIN, EOrder RGB_ORDER> class NEOPIXEL {};
+
+namespace host {
+
+  // WS2811 at 800 kHz: 24 bits x 1.25 us per pixel, plus the 50 us latch
+  const uint32_t SHOW_MICROS_PER_LED = 30;
+  const uint32_t SHOW_LATCH_MICROS = 50;
+
+  // Called by FastLED.show() with the pixels as the sketch left them
+  inline void (*showHook)(const CRGB* leds, int numLeds, uint8_t brightness) = nullptr;
+
+} // namespace host
+
+class CFastLED {
+  public:
+    template <template <uint8_t DATA_PIN, EOrder RGB_ORDER> class CHIPSET, uint8_t DATA_PIN, EOrder RGB_ORDER>
+    CFastLED& addLeds(CRGB* data, int nLeds) {
+      leds = data;
+      numLeds = nLeds;
+      return *this;
+    }
+
+    void setBrightness(uint8_t scale) { brightness = scale; }
+    uint8_t getBrightness() const { return brightness; }
+
+    void setDither(uint8_t ditherMode) { dither = ditherMode; }
+
+    void show() {
+      if (!leds) return;
+      host::advanceMicros(numLeds * host::SHOW_MICROS_PER_LED + host::SHOW_LATCH_MICROS);
+      if (host::showHook) host::showHook(leds, numLeds, brightness);
+    }
+
+    void clear(bool writeData = false) {
+      if (leds) memset((void*)leds, 0, numLeds * sizeof(CRGB));
+      if (writeData) show();
+    }
+
+    int size() const { return numLeds; }
+    CRGB* leds = nullptr;
+
+  private:
+    int numLeds = 0;
+    uint8_t brightness = 255;
+    uint8_t dither = 1;
+};
+
+inline CFastLED FastLED;
+
+#endif
@@ -0,0 +1,606 @@
+// Headless host simulator for RaveShades.ino
+//
+// Builds the unmodified sketch against the shims in host/shims, runs setup()
+// and loop() on a virtual clock, feeds the MSGEQ7 pins from a synthetic beat,
+// and optionally writes every shown frame to a file. The sampler's timer and
+// ADC interrupts (see eqsampler.h) and the buttons' pin change and debounce
+// interrupts (see buttons.h) are simulated between loop() passes. Input can instead come
+// from a WAV file through an MSGEQ7 model (see msgeq7.h), or be replayed from
+// a trace recorded with -DTRACE_INPUT (see trace.h); replays pin the random8()
+// seed and start from the AGC and tempo in the trace's header, so a trace
+// always yields the same frames and beats.
+//
+//   ./rave_sim [options]
+//     -s, --seconds N     virtual seconds to run (per effect with --bench), default 30
+//     -o, --frames FILE   write every shown frame to FILE
+//     -e, --effect N      stay on effect N of the Effects registry instead of auto cycling
+//     -b, --bench         run each registered effect in turn and report wall-clock cost
+//     -w, --wav FILE      take audio from a WAV file; runs to its end unless -s is given
+//         --wav-gain G    scale the WAV input before the filter bank, default 1.0
+//     -a, --audio-only    only run the sampler and doAnalogs(), for fast beat tracking runs
+//     -r, --replay FILE   take audio and button input from a recorded trace
+//         --beats FILE    write beat tracking state after every audio tick (CSV)
+//         --seed N        random16 seed after setup(), default 1337 when replaying
+//         --loop-us N     CPU time charged per loop() pass, default 100
+//         --bpm N         tempo of the synthetic input, default 128
+//         --serial        copy the sketch's Serial output to stderr
+//         --serial-out F  write the sketch's Serial output to F (e.g. a trace)
+//         --serial-in MS:TEXT  deliver TEXT to the sketch's Serial input at MS virtual ms
+//         --eeprom FILE   start from the EEPROM image in FILE, if it exists, and save it
+//                         back on exit, reporting the writes; otherwise start erased
+//     -d, --decode FILE   print the telemetry records in a Serial capture and exit
+//
+// Frame file layout (little endian):
+//   "RSF1", uint8 ledCount
+//   per FastLED.show(): uint32 millis, uint8 brightness, ledCount x (r, g, b)
+// ledCount is LAST_VISIBLE_LED + 1, i.e. the 68 LEDs that are physically present.
+
+#include <Arduino.h>
+
+#include <chrono>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <string>
+
+#include "../RaveShades.ino"
+#include "replay.h"
+#include "decode.h"
+#include "msgeq7.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// eqsampler.h platform layer. The one-shot timer and the ADC each hold the
+// virtual time their interrupt is due; serviceInterrupts() runs every due
+// event in order, with the clock wound back to that event's time, so the
+// sampler sees the same timing it would on the chip. A conversion takes the
+// usual 104 us but no CPU time.
+
+uint64_t timerDueMicros = 0; // 0 when not armed
+uint64_t adcDueMicros = 0;
+
+void eqSchedule(uint16_t delayMicros) {
+  timerDueMicros = host::clockMicros + delayMicros;
+}
+
+void eqStartConversion() {
+  adcDueMicros = host::clockMicros + host::ANALOG_READ_MICROS;
+}
+
+void eqWriteReset(uint8_t level) {
+  digitalWrite(RESETPIN, level);
+}
+
+void eqWriteStrobe(uint8_t level) {
+  digitalWrite(STROBEPIN, level);
+}
+
+void eqSamplerBegin() {
+  eqState = EQ_IDLE;
+  eqFrameStart = micros() - EQ_FRAME_MICROS;
+  eqSchedule(EQ_RESET_MICROS);
+}
+
+void serviceInterrupts() {
+  uint64_t now = host::clockMicros;
+  while (true) {
+    bool timer = timerDueMicros && timerDueMicros <= now && (!adcDueMicros || timerDueMicros <= adcDueMicros);
+    bool adc = !timer && adcDueMicros && adcDueMicros <= now;
+    if (timer) {
+      host::clockMicros = timerDueMicros;
+      timerDueMicros = 0;
+      eqTimerEvent();
+    } else if (adc) {
+      host::clockMicros = adcDueMicros;
+      adcDueMicros = 0;
+      uint16_t reading = host::analogSource ? host::analogSource(ANALOGPIN) : 0;
+      eqConversionDone(reading > 1023 ? 1023 : reading);
+    } else {
+      break;
+    }
+  }
+  host::clockMicros = now;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// buttons.h platform layer. serviceButtons() raises the pin change interrupt
+// when the button levels differ from the last look, then runs the debounce
+// ticks that have come due, each at its own virtual time.
+
+const uint32_t BUTTON_TICK_MICROS = 1024; // Timer0 compare B, once per overflow
+uint64_t buttonTickDueMicros = 0; // 0 when stopped
+uint8_t buttonPinsSeen = 0;
+
+uint8_t buttonReadPins() {
+  return (digitalRead(buttonmap[0]) == LOW ? 1 : 0) | (digitalRead(buttonmap[1]) == LOW ? 2 : 0);
+}
+
+void buttonTickEnable(boolean enable) {
+  if (!enable) {
+    buttonTickDueMicros = 0;
+  } else if (!buttonTickDueMicros) {
+    buttonTickDueMicros = host::clockMicros + BUTTON_TICK_MICROS;
+  }
+}
+
+void buttonsBegin() {
+  buttonPinsSeen = buttonReadPins();
+  buttonTickEnable(true);
+}
+
+void serviceButtons() {
+  uint64_t now = host::clockMicros;
+  uint8_t pins = buttonReadPins();
+  if (pins != buttonPinsSeen) {
+    buttonPinsSeen = pins;
+    buttonPinChange();
+  }
+  while (buttonTickDueMicros && buttonTickDueMicros <= now) {
+    host::clockMicros = buttonTickDueMicros;
+    buttonTickDueMicros += BUTTON_TICK_MICROS;
+    buttonTick();
+  }
+  host::clockMicros = now;
+}
+
+// Earliest pending interrupt, or 0 if none is armed
+uint64_t nextInterruptMicros() {
+  if (!timerDueMicros) return adcDueMicros;
+  if (!adcDueMicros) return timerDueMicros;
+  return timerDueMicros < adcDueMicros ? timerDueMicros : adcDueMicros;
+}
+
+namespace {
+
+typedef std::chrono::steady_clock WallClock;
+
+struct Options {
+  uint32_t seconds = 30;
+  bool secondsGiven = false;
+  const char* framesPath = nullptr;
+  int effect = -1;
+  bool bench = false;
+  uint32_t loopMicros = 100;
+  uint16_t bpm = 128;
+  bool serial = false;
+  const char* serialPath = nullptr;
+  const char* replayPath = nullptr;
+  const char* beatsPath = nullptr;
+  const char* wavPath = nullptr;
+  const char* decodePath = nullptr;
+  uint32_t serialInMillis = 0;
+  const char* serialIn = nullptr;
+  float wavGain = 1.0f;
+  bool audioOnly = false;
+  long seed = -1;
+  const char* eepromPath = nullptr;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// MSGEQ7 model: reset rewinds to the 63 Hz band, each strobe falling edge
+// moves to the next band, and the output pin carries that band's envelope.
+
+int8_t modelBand = -1;
+uint16_t syntheticBpm = 128;
+uint32_t noiseSeed = 12345;
+
+void eqPinChanged(uint8_t pin, uint8_t val) {
+  if (pin == RESETPIN && val == HIGH) {
+    modelBand = -1;
+  } else if (pin == STROBEPIN && val == LOW) {
+    modelBand = (modelBand + 1) % 7;
+  }
+}
+
+uint16_t noise(uint16_t amplitude) {
+  noiseSeed = noiseSeed * 1103515245u + 12345u;
+  return (noiseSeed >> 16) % (amplitude + 1);
+}
+
+// Four-on-the-floor kick, backbeat snare and eighth-note hats, as ADC counts
+uint16_t syntheticBand(uint8_t band, uint64_t nowMicros) {
+  uint32_t beatMicros = 60000000UL / syntheticBpm;
+  uint32_t beat = nowMicros / beatMicros;
+  float sinceBeat = (nowMicros % beatMicros) / 1000.0f;
+  float sinceEighth = (nowMicros % (beatMicros / 2)) / 1000.0f;
+
+  float level = 90;
+  switch (band) {
+    case 0:
+    case 1:
+      level += 750 * expf(-sinceBeat / 70.0f);
+      break;
+    case 2:
+    case 3:
+    case 4:
+      if (beat % 2 == 1) level += 450 * expf(-sinceBeat / 90.0f);
+      break;
+    case 5:
+    case 6:
+      level += 300 * expf(-sinceEighth / 30.0f);
+      break;
+  }
+  return level + noise(40);
+}
+
+bool replaying = false;
+
+bool wavInput = false;
+Msgeq7Model wav;
+
+uint16_t analogInput(uint8_t pin) {
+  if (replaying) return 0;
+  if (wavInput) return pin == ANALOGPIN && modelBand >= 0 ? wav.read(modelBand, host::clockMicros) : 0;
+  if (pin != ANALOGPIN || modelBand < 0) return noise(20);
+  return syntheticBand(modelBand, host::clockMicros);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Frame output
+
+FILE* framesFile = nullptr;
+uint32_t framesShown = 0;
+
+void writeFrame(const CRGB* pixels, int numLeds, uint8_t brightness) {
+  framesShown++;
+  if (!framesFile) return;
+
+  uint32_t now = millis();
+  uint8_t header[5] = {
+    (uint8_t)now, (uint8_t)(now >> 8), (uint8_t)(now >> 16), (uint8_t)(now >> 24), brightness
+  };
+  fwrite(header, 1, sizeof(header), framesFile);
+  for (int i = 0; i <= LAST_VISIBLE_LED && i < numLeds; i++) {
+    fwrite(pixels[i].raw, 1, 3, framesFile);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Beat tracking output, one line per doAnalogs() tick
+
+FILE* beatsFile = nullptr;
+uint32_t lastAudioMillis = 0;
+
+void writeBeats() {
+  if (!beatsFile || audioMillis == lastAudioMillis) return;
+  lastAudioMillis = audioMillis;
+  fprintf(beatsFile, "%u,%d,%u,%u,%u,%u,%u\n", audioMillis, isLocalBassPeak, onsetFlags, millisPerBeat,
+          tempoConfidence, hasPredictedBeat() ? beatPhaseQ24 >> 16 : 0, beatCounter);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Per-effect timing: the registry's render hooks are swapped for a trampoline
+// that times the real one, so loop() itself runs unmodified.
+
+struct Stats {
+  uint32_t count = 0;
+  uint64_t totalNanos = 0;
+  uint64_t minNanos = UINT64_MAX;
+  uint64_t maxNanos = 0;
+
+  void add(uint64_t nanos) {
+    count++;
+    totalNanos += nanos;
+    if (nanos < minNanos) minNanos = nanos;
+    if (nanos > maxNanos) maxNanos = nanos;
+  }
+
+  double meanNanos() const {
+    return count ? (double)totalNanos / count : 0;
+  }
+};
+
+void (*originalEffects[numEffects])(void* state);
+Stats effectStats[numEffects];
+
+void timedEffect(void* state) {
+  byte index = currentEffect;
+  WallClock::time_point start = WallClock::now();
+  originalEffects[index](state);
+  uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(WallClock::now() - start).count();
+  effectStats[index].add(nanos);
+}
+
+void instrumentEffects() {
+  for (byte i = 0; i < numEffects; i++) {
+    originalEffects[i] = Effects::entries[i].render;
+    Effects::entries[i].render = timedEffect;
+  }
+}
+
+std::string effectName(byte index) {
+  Dl_info info;
+  if (dladdr((void*)originalEffects[index], &info) && info.dli_sname) {
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : info.dli_sname;
+    free(demangled);
+    // "void renderEffect<Rider>(void*)" -> "Rider"
+    size_t open = name.find('<');
+    size_t close = name.rfind('>', name.find('('));
+    if (open != std::string::npos && close != std::string::npos && close > open) {
+      return name.substr(open + 1, close - open - 1);
+    }
+    return name.substr(0, name.find('('));
+  }
+  return "effect " + std::to_string(index);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Hand --serial-in text to the sketch once its time has come
+void receiveSerial(const Options& options) {
+  static bool delivered = false;
+  if (!delivered && options.serialIn && millis() >= options.serialInMillis) {
+    Serial.receive(options.serialIn);
+    delivered = true;
+  }
+}
+
+void runFor(uint32_t seconds, const Options& options, Stats* loopStats) {
+  uint64_t end = host::clockMicros + (uint64_t)seconds * 1000000;
+  while (host::clockMicros < end && !(wavInput && wav.finished())) {
+    serviceInterrupts();
+    serviceButtons();
+    receiveSerial(options);
+    WallClock::time_point start = WallClock::now();
+    loop();
+    if (loopStats) {
+      loopStats->add(std::chrono::duration_cast<std::chrono::nanoseconds>(WallClock::now() - start).count());
+    }
+    writeBeats();
+    host::advanceMicros(options.loopMicros);
+  }
+}
+
+// Only the audio path: the sampler's interrupts and doAnalogs() for each frame, no rendering
+void runAudioOnly(uint32_t seconds) {
+  uint64_t end = host::clockMicros + (uint64_t)seconds * 1000000;
+  while (host::clockMicros < end && !(wavInput && wav.finished())) {
+    host::clockMicros = nextInterruptMicros();
+    serviceInterrupts();
+    if (eqFrameReady) {
+      currentMillis = millis();
+      audioMillis = currentMillis;
+      doAnalogs();
+      writeBeats();
+    }
+  }
+}
+
+// Run loop() until the trace is exhausted. The sampler's interrupts don't run;
+// instead each recorded tick is published as the sampler's frame, and its
+// button levels become the inputs, before the first pass at or after its time.
+void runReplay(TraceReader& trace, const Options& options) {
+  TraceRecord tick;
+  bool pending = trace.next(tick);
+  while (pending) {
+    if (millis() >= tick.millis) {
+      host::pinLevel[MODEBUTTON] = tick.modeButton;
+      host::pinLevel[BRIGHTNESSBUTTON] = tick.brightnessButton;
+      for (byte i = 0; i < 7; i++) {
+        eqFrames[!eqFront][i] = tick.samples[i];
+      }
+      eqPublishFrame();
+      pending = trace.next(tick);
+    }
+    serviceButtons();
+    receiveSerial(options);
+    loop();
+    writeBeats();
+    host::advanceMicros(options.loopMicros);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EEPROM image, so settings and learned state carry over between runs
+
+void loadEEPROM(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return; // first run: start erased
+  size_t read = fread(host::eeprom, 1, host::EEPROM_SIZE, file);
+  fclose(file);
+  fprintf(stderr, "EEPROM: loaded %zu bytes from %s\n", read, path);
+}
+
+bool saveEEPROM(const char* path) {
+  uint32_t total = 0, most = 0;
+  for (uint16_t i = 0; i < host::EEPROM_SIZE; i++) {
+    total += host::eepromWrites[i];
+    most = std::max(most, host::eepromWrites[i]);
+  }
+  fprintf(stderr, "EEPROM: %u writes this run, at most %u to one cell\n", total, most);
+
+  FILE* file = fopen(path, "wb");
+  if (!file || fwrite(host::eeprom, 1, host::EEPROM_SIZE, file) != host::EEPROM_SIZE) {
+    perror(path);
+    if (file) fclose(file);
+    return false;
+  }
+  fclose(file);
+  return true;
+}
+
+void selectEffect(byte index) {
+  currentEffect = index;
+  autoCycle = false;
+  effectInit = false;
+}
+
+void usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s [-s seconds] [-o frames.bin] [-e effect] [-b] [-w audio.wav] [--wav-gain G] [-a]\n"
+          "       [-r trace.bin] [--beats beats.csv] [--seed N] [--loop-us N] [--bpm N]\n"
+          "       [--serial] [--serial-out file] [--serial-in ms:text] [--eeprom image.bin]\n"
+          "       %s -d capture.bin\n",
+          argv0, argv0);
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if ((arg == "-s" || arg == "--seconds") && hasValue) {
+      options.seconds = strtoul(argv[++i], nullptr, 10);
+      options.secondsGiven = true;
+    } else if ((arg == "-o" || arg == "--frames") && hasValue) {
+      options.framesPath = argv[++i];
+    } else if ((arg == "-e" || arg == "--effect") && hasValue) {
+      options.effect = atoi(argv[++i]);
+    } else if (arg == "-b" || arg == "--bench") {
+      options.bench = true;
+    } else if (arg == "--loop-us" && hasValue) {
+      options.loopMicros = strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--bpm" && hasValue) {
+      options.bpm = strtoul(argv[++i], nullptr, 10);
+    } else if ((arg == "-w" || arg == "--wav") && hasValue) {
+      options.wavPath = argv[++i];
+    } else if (arg == "--wav-gain" && hasValue) {
+      options.wavGain = strtof(argv[++i], nullptr);
+    } else if (arg == "-a" || arg == "--audio-only") {
+      options.audioOnly = true;
+    } else if ((arg == "-r" || arg == "--replay") && hasValue) {
+      options.replayPath = argv[++i];
+    } else if (arg == "--beats" && hasValue) {
+      options.beatsPath = argv[++i];
+    } else if (arg == "--seed" && hasValue) {
+      options.seed = strtol(argv[++i], nullptr, 10);
+    } else if ((arg == "-d" || arg == "--decode") && hasValue) {
+      options.decodePath = argv[++i];
+    } else if (arg == "--serial-in" && hasValue) {
+      char* text;
+      options.serialInMillis = strtoul(argv[++i], &text, 10);
+      if (*text != ':') return false;
+      options.serialIn = text + 1;
+    } else if (arg == "--serial") {
+      options.serial = true;
+    } else if (arg == "--serial-out" && hasValue) {
+      options.serialPath = argv[++i];
+    } else if (arg == "--eeprom" && hasValue) {
+      options.eepromPath = argv[++i];
+    } else {
+      return false;
+    }
+  }
+  return options.effect < numEffects && options.bpm > 0 && !(options.bench && options.replayPath) &&
+         !(options.wavPath && options.replayPath) && !(options.audioOnly && (options.bench || options.replayPath));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (options.decodePath) {
+    TelemetryReader telemetry;
+    if (!telemetry.open(options.decodePath)) {
+      perror(options.decodePath);
+      return 1;
+    }
+    TelemetryRecord record;
+    while (telemetry.next(record)) printTelemetry(record, stdout);
+    fprintf(stderr, "%u records (%u dropped by the firmware, %u bytes skipped)\n", telemetry.records,
+            telemetry.dropped, telemetry.skippedBytes);
+    return 0;
+  }
+
+  if (options.framesPath) {
+    framesFile = fopen(options.framesPath, "wb");
+    if (!framesFile) {
+      perror(options.framesPath);
+      return 1;
+    }
+    uint8_t ledCount = LAST_VISIBLE_LED + 1;
+    fwrite("RSF1", 1, 4, framesFile);
+    fwrite(&ledCount, 1, 1, framesFile);
+  }
+
+  TraceReader trace;
+  if (options.replayPath) {
+    if (!trace.open(options.replayPath)) {
+      perror(options.replayPath);
+      return 1;
+    }
+    replaying = true;
+    if (options.seed < 0) options.seed = 1337;
+  }
+
+  if (options.wavPath) {
+    if (!wav.open(options.wavPath)) {
+      fprintf(stderr, "%s: %s\n", options.wavPath, wav.error);
+      return 1;
+    }
+    wav.gain = options.wavGain;
+    wavInput = true;
+    if (!options.secondsGiven) options.seconds = ceil(wav.durationSeconds()) + 1;
+  }
+
+  if (options.beatsPath) {
+    beatsFile = fopen(options.beatsPath, "w");
+    if (!beatsFile) {
+      perror(options.beatsPath);
+      return 1;
+    }
+    fprintf(beatsFile, "millis,bassPeak,onsets,millisPerBeat,tempoConfidence,beatPhase,beatCounter\n");
+  }
+
+  host::resetPins();
+  host::eraseEEPROM();
+  if (options.eepromPath) loadEEPROM(options.eepromPath);
+  host::analogSource = analogInput;
+  host::digitalWriteHook = eqPinChanged;
+  host::showHook = writeFrame;
+  syntheticBpm = options.bpm;
+  if (options.serial) Serial.sink = stderr;
+  if (options.serialPath && !(Serial.sink = fopen(options.serialPath, "wb"))) {
+    perror(options.serialPath);
+    return 1;
+  }
+
+  instrumentEffects();
+  setup();
+  if (options.seed >= 0) random16_set_seed(options.seed);
+
+  if (options.bench) {
+    printf("%-22s %8s %10s %10s %10s %10s\n", "effect", "calls", "min ns", "mean ns", "max ns", "loop ns");
+    for (byte i = 0; i < numEffects; i++) {
+      Stats loopStats;
+      selectEffect(i);
+      runFor(options.seconds, options, &loopStats);
+      const Stats& s = effectStats[i];
+      printf("%-22s %8u %10llu %10.0f %10llu %10.0f\n", effectName(i).c_str(), s.count,
+             (unsigned long long)(s.count ? s.minNanos : 0), s.meanNanos(),
+             (unsigned long long)s.maxNanos, loopStats.meanNanos());
+    }
+  } else if (replaying) {
+    TraceHeader header;
+    if (trace.header(header)) {
+      applyTraceHeader(header);
+      fprintf(stderr, "trace header: settings record %u, AGC average %.2f, %u ms per beat at confidence %u\n",
+              header.settingsSequence, header.audioAvgQ16 / 65536.0, header.millisPerBeat, header.tempoConfidence);
+    }
+    if (options.effect >= 0) selectEffect(options.effect);
+    runReplay(trace, options);
+    fprintf(stderr, "%u records replayed (%u dropped by the firmware, %u bytes skipped), %u frames\n",
+            trace.records, trace.dropped, trace.skippedBytes, framesShown);
+  } else {
+    WallClock::time_point start = WallClock::now();
+    if (options.audioOnly) {
+      runAudioOnly(options.seconds);
+    } else {
+      if (options.effect >= 0) selectEffect(options.effect);
+      runFor(options.seconds, options, nullptr);
+    }
+    double wallSeconds = std::chrono::duration<double>(WallClock::now() - start).count();
+    fprintf(stderr, "%u frames in %u virtual ms, %.2f s wall clock (%.0fx real time)\n", framesShown, millis(),
+            wallSeconds, millis() / 1000.0 / wallSeconds);
+  }
+
+  if (options.eepromPath && !saveEEPROM(options.eepromPath)) return 1;
+  if (framesFile) fclose(framesFile);
+  if (beatsFile) fclose(beatsFile);
+  if (Serial.sink && Serial.sink != stderr) fclose(Serial.sink);
+  return 0;
+}
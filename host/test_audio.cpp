@@ -0,0 +1,169 @@
+// Fixed-point audio pipeline against its float original
+//
+// Feeds the same MSGEQ7 frames to the sketch's doAnalogs() and to a float
+// model of the pipeline as it stood before the move to fixed point, and checks
+// every tick: gained band values, smoothed and peak levels within 2 counts or
+// 1.5% (whichever is larger), AGC gain within 0.01, the tolerance audio.h
+// states. Exits non-zero on the first tick that drifts past it.
+//
+// The input runs through sections that pull the AGC across its range: a
+// normal beat, a quiet one (gain climbs), near silence (gain pinned at
+// GAINUPPERLIMIT), a clipping one (gain falls) and the normal beat again.
+//
+//   ./test_audio [-v]    -v prints the worst error per section
+
+#include <Arduino.h>
+
+#include "../RaveShades.ino"
+
+// The test drives doAnalogs() directly, so the sampler and button interrupts never run
+void eqSchedule(uint16_t delayMicros) {}
+void eqStartConversion() {}
+void eqWriteReset(uint8_t level) {}
+void eqWriteStrobe(uint8_t level) {}
+void eqSamplerBegin() {}
+uint8_t buttonReadPins() { return 0; }
+void buttonTickEnable(boolean enable) {}
+void buttonsBegin() {}
+
+namespace {
+
+///////////////////////////////////////////////////////////////////////////////
+// The float pipeline, in float throughout like avr-gcc's 32-bit double
+
+struct FloatAudio {
+  unsigned int value[7];
+  float decay[7] = {0};
+  float peaks[7] = {0};
+  float audioAvg = AGCTARGET;
+  float gainAGC = 1.0f;
+
+  void tick(const uint16_t* raw) {
+    static const byte spectrumFactors[7] = {8, 8, 9, 8, 7, 3, 10};
+    unsigned int analogsum = 0;
+
+    for (int i = 0; i < 7; i++) {
+      value[i] = raw[i] < NOISEFLOOR ? 0 : raw[i] - NOISEFLOOR;
+      value[i] = value[i] * spectrumFactors[i] / 10;
+      analogsum += value[i];
+      value[i] *= gainAGC;
+      decay[i] = (1.0f - (float)SPECTRUMSMOOTH) * decay[i] + (float)SPECTRUMSMOOTH * value[i];
+      peaks[i] = std::max(peaks[i] * PEAKDECAY, decay[i]);
+    }
+
+    audioAvg = (1.0f - (float)AGCSMOOTH) * audioAvg + (float)AGCSMOOTH * (analogsum / 7.0f);
+    gainAGC = constrain((float)AGCTARGET / audioAvg, (float)GAINLOWERLIMIT, (float)GAINUPPERLIMIT);
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Input
+
+uint32_t noiseSeed = 12345;
+
+uint16_t inputNoise(uint16_t amplitude) {
+  noiseSeed = noiseSeed * 1103515245u + 12345u;
+  return (noiseSeed >> 16) % (amplitude + 1);
+}
+
+// The simulator's kick, snare and hats at 128 BPM, scaled, in ADC counts
+uint16_t beatBand(uint8_t band, uint32_t nowMillis, float scale) {
+  const uint32_t beatMillis = 60000 / 128;
+  uint32_t beat = nowMillis / beatMillis;
+  float sinceBeat = nowMillis % beatMillis;
+  float sinceEighth = nowMillis % (beatMillis / 2);
+
+  float level = 90;
+  if (band <= 1) {
+    level += 750 * expf(-sinceBeat / 70.0f);
+  } else if (band <= 4) {
+    if (beat % 2 == 1) level += 450 * expf(-sinceBeat / 90.0f);
+  } else {
+    level += 300 * expf(-sinceEighth / 30.0f);
+  }
+  level = level * scale + inputNoise(40);
+  return level > 1023 ? 1023 : (uint16_t)level;
+}
+
+struct Section {
+  const char* name;
+  uint32_t seconds;
+  float scale; // of the beat; 0 for noise under NOISEFLOOR only
+};
+
+const Section sections[] = {
+  { "beat", 60, 1.0f },
+  { "quiet", 120, 0.8f },
+  { "silence", 60, 0 },
+  { "clipping", 60, 4.0f },
+  { "beat again", 60, 1.0f },
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Comparison
+
+struct Worst {
+  float level = 0; // largest level error beyond which the check would fail, as a fraction of its tolerance
+  float gain = 0;
+};
+
+bool levelWithin(float fixed, float reference, float& worst) {
+  float tolerance = std::max(2.0f, 0.015f * reference);
+  float ratio = fabsf(fixed - reference) / tolerance;
+  worst = std::max(worst, ratio);
+  return ratio <= 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  bool verbose = argc > 1 && !strcmp(argv[1], "-v");
+  FloatAudio reference;
+  uint32_t nowMillis = 0;
+  uint32_t ticks = 0;
+
+  for (const Section& section : sections) {
+    Worst worst;
+    uint32_t end = nowMillis + section.seconds * 1000;
+    for (; nowMillis < end; nowMillis += AUDIODELAY) {
+      uint16_t raw[7];
+      for (uint8_t band = 0; band < 7; band++) {
+        raw[band] = section.scale > 0 ? beatBand(band, nowMillis, section.scale) : inputNoise(NOISEFLOOR - 1);
+        eqFrames[!eqFront][band] = raw[band];
+      }
+      eqPublishFrame();
+      currentMillis = nowMillis;
+      doAnalogs();
+      reference.tick(raw);
+      ticks++;
+
+      bool ok = true;
+      for (uint8_t band = 0; band < 7; band++) {
+        ok &= levelWithin(spectrumValue[band], reference.value[band], worst.level);
+        ok &= levelWithin(spectrumDecayQ8[band] / 256.0f, reference.decay[band], worst.level);
+        ok &= levelWithin(spectrumPeaksQ8[band] / 256.0f, reference.peaks[band], worst.level);
+      }
+      float gainError = fabsf(gainAGCQ8 / 256.0f - reference.gainAGC);
+      worst.gain = std::max(worst.gain, gainError);
+      ok &= gainError <= 0.01f;
+
+      if (!ok) {
+        fprintf(stderr, "FAIL at %u ms (%s): gain %.4f vs %.4f\n", nowMillis, section.name, gainAGCQ8 / 256.0f,
+                reference.gainAGC);
+        for (uint8_t band = 0; band < 7; band++) {
+          fprintf(stderr, "  band %u: value %u vs %u, decay %.2f vs %.2f, peak %.2f vs %.2f\n", band,
+                  spectrumValue[band], reference.value[band], spectrumDecayQ8[band] / 256.0f, reference.decay[band],
+                  spectrumPeaksQ8[band] / 256.0f, reference.peaks[band]);
+        }
+        return 1;
+      }
+    }
+    if (verbose) {
+      printf("%-12s gain %.4f, worst level error %.0f%% of tolerance, worst gain error %.4f\n", section.name,
+             reference.gainAGC, worst.level * 100, worst.gain);
+    }
+  }
+
+  printf("test_audio: %u ticks within tolerance\n", ticks);
+  return 0;
+}
@@ -0,0 +1,134 @@
+// Serial record formats: round trips and interleaving
+//
+// Trace records, the trace header and telemetry records share one Serial
+// stream, all 16 bytes long with a CRC8 over bytes 1..14, so only the sync
+// byte tells them apart. Checks that each decoder reads back what its encoder
+// wrote and rejects the other formats, and that TraceReader and
+// TelemetryReader pick their own records out of a capture that mixes all
+// three, with no false sequence gaps.
+//
+//   ./test_trace
+
+#include <Arduino.h>
+
+#include "../RaveShades.ino"
+#include "decode.h"
+#include "replay.h"
+
+#include <unistd.h>
+
+// Only the codecs are used, so the sampler and button interrupts never run
+void eqSchedule(uint16_t delayMicros) {}
+void eqStartConversion() {}
+void eqWriteReset(uint8_t level) {}
+void eqWriteStrobe(uint8_t level) {}
+void eqSamplerBegin() {}
+uint8_t buttonReadPins() { return 0; }
+void buttonTickEnable(boolean enable) {}
+void buttonsBegin() {}
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+  if (!ok) {
+    fprintf(stderr, "FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+TraceRecord makeTrace(uint8_t sequence) {
+  TraceRecord record = { sequence, 123456u + sequence * 9u, { 0, 1023, 512, 7, 300, 900, 64 }, 1, 0 };
+  return record;
+}
+
+TraceHeader makeHeader() {
+  TraceHeader header = { 0xBEEF, 0x004E8000, 469, 80 };
+  return header;
+}
+
+TelemetryRecord makeTelemetry(uint8_t sequence) {
+  TelemetryRecord record = { TELEMETRY_STATUS, sequence, 98765u + sequence * 1000u, { 0xD5, 0x01, 80, 0x00, 0x02, 3, 1, 9 } };
+  return record;
+}
+
+void checkRoundTrips() {
+  uint8_t trace[TRACE_RECORD_SIZE], header[TRACE_RECORD_SIZE], telemetry[TELEMETRY_RECORD_SIZE];
+  TraceRecord traceIn = makeTrace(42), traceOut;
+  TraceHeader headerIn = makeHeader(), headerOut;
+  TelemetryRecord telemetryIn = makeTelemetry(17), telemetryOut;
+  traceEncode(traceIn, trace);
+  traceEncodeHeader(headerIn, header);
+  telemetryEncode(telemetryIn, telemetry);
+
+  check(traceDecode(trace, traceOut), "trace record decodes");
+  check(traceOut.sequence == traceIn.sequence && traceOut.millis == traceIn.millis &&
+            !memcmp(traceOut.samples, traceIn.samples, sizeof(traceIn.samples)) &&
+            traceOut.modeButton == traceIn.modeButton && traceOut.brightnessButton == traceIn.brightnessButton,
+        "trace record round trip");
+  check(traceDecodeHeader(header, headerOut), "trace header decodes");
+  check(headerOut.settingsSequence == headerIn.settingsSequence && headerOut.audioAvgQ16 == headerIn.audioAvgQ16 &&
+            headerOut.millisPerBeat == headerIn.millisPerBeat && headerOut.tempoConfidence == headerIn.tempoConfidence,
+        "trace header round trip");
+  check(telemetryDecode(telemetry, telemetryOut), "telemetry record decodes");
+  check(telemetryOut.type == telemetryIn.type && telemetryOut.sequence == telemetryIn.sequence &&
+            telemetryOut.millis == telemetryIn.millis && !memcmp(telemetryOut.payload, telemetryIn.payload, TELEMETRY_PAYLOAD_SIZE),
+        "telemetry record round trip");
+
+  check(!traceDecode(header, traceOut), "trace decoder rejects a trace header");
+  check(!traceDecode(telemetry, traceOut), "trace decoder rejects a telemetry record");
+  check(!traceDecodeHeader(trace, headerOut), "header decoder rejects a trace record");
+  check(!traceDecodeHeader(telemetry, headerOut), "header decoder rejects a telemetry record");
+  check(!telemetryDecode(trace, telemetryOut), "telemetry decoder rejects a trace record");
+  check(!telemetryDecode(header, telemetryOut), "telemetry decoder rejects a trace header");
+}
+
+// A capture from a build with both TRACE_INPUT and TELEMETRY_LEVEL: the header,
+// then trace records with a telemetry record after every fourth, and debug text
+void checkInterleaved() {
+  std::vector<uint8_t> capture;
+  uint8_t encoded[TRACE_RECORD_SIZE];
+  traceEncodeHeader(makeHeader(), encoded);
+  capture.insert(capture.end(), encoded, encoded + TRACE_RECORD_SIZE);
+  const char text[] = "debug\r\n";
+  for (uint8_t i = 0; i < 40; i++) {
+    traceEncode(makeTrace(i), encoded);
+    capture.insert(capture.end(), encoded, encoded + TRACE_RECORD_SIZE);
+    if (i % 4 == 3) {
+      telemetryEncode(makeTelemetry(i / 4), encoded);
+      capture.insert(capture.end(), encoded, encoded + TELEMETRY_RECORD_SIZE);
+      capture.insert(capture.end(), text, text + sizeof(text) - 1);
+    }
+  }
+
+  char path[] = "/tmp/test_traceXXXXXX";
+  int fd = mkstemp(path);
+  check(fd >= 0 && write(fd, capture.data(), capture.size()) == (ssize_t)capture.size(), "write the capture");
+  if (fd >= 0) close(fd);
+
+  TraceReader trace;
+  check(trace.open(path), "open the capture as a trace");
+  TraceHeader header;
+  check(trace.header(header) && header.settingsSequence == makeHeader().settingsSequence, "trace header found");
+  TraceRecord record;
+  while (trace.next(record)) {}
+  check(trace.records == 40 && trace.dropped == 0, "trace records picked out, no gaps");
+
+  TelemetryReader telemetry;
+  check(telemetry.open(path), "open the capture as telemetry");
+  TelemetryRecord status;
+  while (telemetry.next(status)) {}
+  check(telemetry.records == 10 && telemetry.dropped == 0, "telemetry records picked out, no gaps");
+  unlink(path);
+}
+
+} // namespace
+
+int main() {
+  checkRoundTrips();
+  checkInterleaved();
+  if (failures) return 1;
+  printf("test_trace: trace, header and telemetry records decode apart\n");
+  return 0;
+}
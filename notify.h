@@ -0,0 +1,75 @@
+// Notifications
+//
+// Button actions confirm themselves by blinking the whole display: count
+// blinks of NOTIFYBLINKMILLIS lit, each followed by as long dark. notify()
+// queues a pattern and loop() plays it over the following frames with
+// updateNotification(), so audio sampling and beat tracking keep running. While
+// one plays, the output stage shows it over everything else, crossfades
+// included; the effects keep running underneath.
+//
+// The queue plays in order of priority, then of arrival. A notification with a
+// higher priority than the one playing cuts it short; when the queue is full
+// the lowest priority one is dropped.
+
+#define NOTIFYBLINKMILLIS 200
+#define NOTIFYQUEUESIZE 4
+
+// Priorities
+#define NOTIFY_AUTOCYCLE 0 // auto cycle mode toggled
+#define NOTIFY_AUDIO 1     // audio effect set toggled
+
+struct Notification {
+  CRGB color;
+  byte count;
+  byte priority;
+};
+
+Notification notifyQueue[NOTIFYQUEUESIZE]; // next to play first
+byte notifyQueued = 0;
+Notification notifyPlaying;
+boolean notifyActive = false; // notifyPlaying is on the display
+boolean notifyLit = false; // in a lit part of the pattern rather than a dark one
+uint32_t notifyStartMillis = 0;
+
+void notify(CRGB color, byte count, byte priority) {
+  Notification notification = {color, count, priority};
+
+  if (notifyActive && priority > notifyPlaying.priority) {
+    notifyActive = false; // updateNotification() starts the new one straight away
+  }
+
+  // after every queued notification of the same or higher priority
+  byte position = 0;
+  while (position < notifyQueued && notifyQueue[position].priority >= priority) position++;
+  if (position >= NOTIFYQUEUESIZE) return;
+
+  byte last = notifyQueued < NOTIFYQUEUESIZE ? notifyQueued : NOTIFYQUEUESIZE - 1;
+  for (byte i = last; i > position; i--) {
+    notifyQueue[i] = notifyQueue[i - 1];
+  }
+  notifyQueue[position] = notification;
+  if (notifyQueued < NOTIFYQUEUESIZE) notifyQueued++;
+}
+
+// Start and step notifications; true when the display has to change
+boolean updateNotification(uint32_t nowMillis) {
+  boolean wasActive = notifyActive;
+  boolean wasLit = notifyLit;
+
+  if (notifyActive && nowMillis - notifyStartMillis >= 2UL * NOTIFYBLINKMILLIS * notifyPlaying.count) {
+    notifyActive = false;
+  }
+
+  if (!notifyActive && notifyQueued > 0) {
+    notifyPlaying = notifyQueue[0];
+    for (byte i = 1; i < notifyQueued; i++) {
+      notifyQueue[i - 1] = notifyQueue[i];
+    }
+    notifyQueued--;
+    notifyActive = true;
+    notifyStartMillis = nowMillis;
+  }
+
+  notifyLit = notifyActive && ((nowMillis - notifyStartMillis) / NOTIFYBLINKMILLIS) % 2 == 0;
+  return notifyActive != wasActive || notifyLit != wasLit || (notifyActive && nowMillis == notifyStartMillis);
+}
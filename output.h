@@ -0,0 +1,213 @@
+// Output stage
+//
+// leds[] is the effects' canvas: they draw into it and some read it back
+// (scrolling, trails left by fadeActive). Above it sits the overlay layer,
+// overlay_leds[], where an effect's overlay() hook draws beat markers and the
+// like once per frame; overlayMask marks the pixels it covers. Once per shown
+// frame, renderOutput() makes a single pass over the visible pixels that
+//   * fades the canvas by the decay that has elapsed since the last frame
+//   * blends in the overlay where it covers the canvas (add, max or alpha)
+//   * shows a notification (notify.h) instead, while one is playing
+//   * gamma-corrects each pixel and scales it to the selected brightness
+//   * during a crossfade, blends from the frame shown last
+//   * adds up the current it will draw
+// and writes the result back over overlay_leds[], which is what FastLED sends
+// (at full FastLED brightness). The overlay is redrawn before every frame, so
+// it is only needed until its pixel has been composited. If the frame would
+// draw more than MAXMILLIAMPS it is scaled down to fit.
+
+uint8_t outputBrightness = 255; // brightVals level scaled to MAXBRIGHTNESS
+boolean frameDirty = true; // leds[] changed since the last show()
+uint32_t frameMicros = 0; // start of the current frame period
+boolean frameLate = false; // the current frame period started a whole period or more late
+uint32_t fadeMicros = 0; // time up to which fade steps have been applied
+
+// Overlay layer
+#define OVERLAY_ADD 0   // saturating add onto the canvas
+#define OVERLAY_MAX 1   // brighter of the two, per channel
+#define OVERLAY_ALPHA 2 // blend by overlayAlpha; 255 replaces the canvas pixel
+
+uint8_t overlayMask[(LAST_VISIBLE_LED + 8) / 8]; // one bit per visible LED
+uint8_t overlayBlend = OVERLAY_ALPHA;
+uint8_t overlayAlpha = 255;
+boolean overlayDirty = false; // the overlay changed since the last show()
+
+// Drop everything on the overlay layer
+void clearOverlay() {
+  for (byte i = 0; i < sizeof(overlayMask); i++) {
+    if (overlayMask[i]) {
+      overlayMask[i] = 0;
+      overlayDirty = true;
+    }
+  }
+}
+
+// Empty layer and default blending, for a newly selected effect
+void resetOverlay() {
+  clearOverlay();
+  overlayBlend = OVERLAY_ALPHA;
+  overlayAlpha = 255;
+}
+
+void setOverlayPixel(byte index, CRGB color) {
+  overlay_leds[index] = color;
+  overlayMask[index >> 3] |= 1 << (index & 7);
+  overlayDirty = true;
+}
+
+CRGB blendOverlay(CRGB pixel, const CRGB& overlay) {
+  switch (overlayBlend) {
+    case OVERLAY_ADD:
+      return pixel += overlay;
+    case OVERLAY_MAX:
+      return CRGB(std::max(pixel.r, overlay.r), std::max(pixel.g, overlay.g), std::max(pixel.b, overlay.b));
+    default:
+      return nblend(pixel, overlay, overlayAlpha);
+  }
+}
+
+// Frame pacing
+#define FRAMEMICROS (1000000UL / TARGETFPS)
+
+// Crossfade between effects
+//
+// With the frame built in overlay_leds there is no buffer left for a second
+// canvas: an outgoing effect kept running in overlay_leds would read back the
+// shown frame instead of its own. So when the effect changes, the fade starts
+// from the last frame shown, still in overlay_leds. For the next
+// CROSSFADEFRAMES shown frames the output moves from the frame before toward
+// the incoming effect, each time by 1/n of the way with n frames to go, so the
+// fade is linear and its last frame is the incoming effect's own. The overlay
+// layer is suspended meanwhile. Each frame period missed while fading halves
+// the rest of the fade, so a slow effect can't drag it out.
+
+boolean crossfading = false;
+uint8_t crossfadeFramesLeft = 0;
+uint8_t crossfadeAmount = 0; // of the incoming effect in this frame
+
+void beginCrossfade() {
+  crossfading = true;
+  crossfadeFramesLeft = CROSSFADEFRAMES;
+  clearOverlay();
+}
+
+// Move the crossfade on by one frame
+void advanceCrossfade() {
+  if (frameLate) crossfadeFramesLeft = (crossfadeFramesLeft + 1) / 2;
+  crossfadeAmount = 255 / crossfadeFramesLeft;
+  if (--crossfadeFramesLeft == 0) crossfading = false;
+}
+
+// True once per frame period; stays on the frame grid unless a whole period was missed
+boolean frameDue() {
+  uint32_t elapsed = micros() - frameMicros;
+  if (elapsed < FRAMEMICROS) return false;
+  frameLate = elapsed >= 2 * FRAMEMICROS;
+  frameMicros = frameLate ? micros() : frameMicros + FRAMEMICROS;
+  return true;
+}
+
+// Effects' fadeActive amounts were tuned for one fade per loop() pass, which
+// took about FADESTEPMICROS while every pass waited on show(). Fades now run
+// once per frame, so combine the steps that have elapsed into one amount.
+#define FADESTEPMICROS 2200
+#define FADEMAXSTEPS 16 // enough to reach black from any fadeActive in use
+
+// Fade steps elapsed since the last call
+byte fadeSteps() {
+  uint32_t now = micros();
+  uint32_t steps = (now - fadeMicros) / FADESTEPMICROS;
+  if (steps > FADEMAXSTEPS) {
+    steps = FADEMAXSTEPS;
+    fadeMicros = now;
+  } else {
+    fadeMicros += steps * FADESTEPMICROS;
+  }
+  return steps;
+}
+
+// fadeIncr applied steps times, as a single amount
+byte fadeStepsAmount(byte fadeIncr, byte steps) {
+  byte keep = 255 - fadeIncr;
+  byte combined = steps ? keep : 255;
+  for (byte i = 1; i < steps; i++) {
+    combined = scale8(combined, keep);
+  }
+  return 255 - combined;
+}
+
+// Set the output brightness from a brightVals level
+void setOutputBrightness(byte brightness) {
+  outputBrightness = scale8(brightness, MAXBRIGHTNESS);
+  frameDirty = true;
+}
+
+#ifdef GAMMACORRECT
+// round(255 * (i / 255)^2.2), but at least 1 for any lit channel
+const uint8_t GammaTable[256] PROGMEM = {
+    0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+    3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+    6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+   12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+   20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+   30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+   42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+   56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+   73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+   91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+  113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+  137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+  163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+  192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+  223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255
+};
+
+#define outputGamma(value) pgm_read_byte(&GammaTable[value])
+#else
+#define outputGamma(value) (value)
+#endif
+
+// Current draw of one fully lit channel and of an unlit pixel, in mA
+#define REDMILLIAMPS 16
+#define GREENMILLIAMPS 11
+#define BLUEMILLIAMPS 15
+#define DARKMILLIAMPS 1
+
+// Fade the canvas by fadeIncr and build the output in overlay_leds[] from it
+// and the overlay
+void renderOutput(byte fadeIncr) {
+  byte keep = 255 - fadeIncr;
+  uint16_t red = 0, green = 0, blue = 0; // channel totals after scaling
+  overlayDirty = false;
+
+  for (byte i = 0; i <= LAST_VISIBLE_LED; i++) {
+    CRGB pixel = leds[i];
+    if (keep != 255) {
+      pixel.nscale8(keep);
+      leds[i] = pixel;
+    }
+    if (overlayMask[i >> 3] & (1 << (i & 7))) {
+      pixel = blendOverlay(pixel, overlay_leds[i]);
+    }
+    if (notifyActive) pixel = notifyLit ? notifyPlaying.color : CRGB(CRGB::Black);
+    pixel.r = scale8_video(outputGamma(pixel.r), outputBrightness);
+    pixel.g = scale8_video(outputGamma(pixel.g), outputBrightness);
+    pixel.b = scale8_video(outputGamma(pixel.b), outputBrightness);
+    if (crossfading && !notifyActive) pixel = blend(overlay_leds[i], pixel, crossfadeAmount);
+    overlay_leds[i] = pixel;
+    red += pixel.r;
+    green += pixel.g;
+    blue += pixel.b;
+  }
+
+  // everything in units of 1/255 mA
+  const uint32_t budget = (uint32_t)(MAXMILLIAMPS - DARKMILLIAMPS * (LAST_VISIBLE_LED + 1)) * 255;
+  uint32_t total = (uint32_t)red * REDMILLIAMPS + (uint32_t)green * GREENMILLIAMPS + (uint32_t)blue * BLUEMILLIAMPS;
+  if (total > budget) {
+    byte scale = budget * 255 / total;
+    for (byte i = 0; i <= LAST_VISIBLE_LED; i++) {
+      overlay_leds[i].nscale8(scale);
+    }
+  }
+}
@@ -0,0 +1,142 @@
+// Palette library
+//
+// Palettes live in flash and are selected by index: either up to four colours
+// spread evenly over the palette, as CRGBPalette16(c1, ..., c4) would, or one
+// of FastLED's 16-entry palettes. currentPalette and currentOverlayPalette
+// blend toward their target palettes only while a transition is in progress.
+// The main palette is expanded into paletteCache once per frame after it
+// changes, so effects read colours with paletteColor() instead of
+// interpolating with ColorFromPalette().
+
+struct PaletteDef {
+  const TProgmemRGBPalette16* fixed; // a FastLED palette, or nullptr
+  uint8_t stops;                     // otherwise 2-4 colours in colors[]
+  uint32_t colors[4];
+};
+
+#define PALETTE_RAINBOW 0
+#define PALETTE_PARTY 1
+#define PALETTE_HEAT 2
+#define AUDIOPALETTES 7        // 0 to AUDIOPALETTES - 1 suit the audio effects
+#define NOISEPALETTE_FIRST 7
+#define NOISEPALETTES 4
+
+const PaletteDef PaletteLibrary[] PROGMEM = {
+  // audio
+  {&RainbowColors_p, 0, {0}},
+  {&PartyColors_p, 0, {0}},
+  {&HeatColors_p, 0, {0}},
+  {nullptr, 3, {CRGB::Red, CRGB::Orange, CRGB::Violet}},
+  {nullptr, 4, {CRGB::Cyan, CRGB::LightSeaGreen, CRGB::BlueViolet, CRGB::Red}},
+  {nullptr, 3, {CRGB::LightSkyBlue, CRGB::LightCoral, CRGB::MediumVioletRed}},
+  {nullptr, 4, {CRGB::Fuchsia, CRGB::DeepPink, CRGB::HotPink, CRGB::Salmon}},
+
+  // noise
+  {nullptr, 4, {CRGB::Black, CRGB::Red, CRGB::Black, CRGB::Blue}},
+  {nullptr, 3, {CRGB::DarkGreen, CRGB::Black, CRGB::Green}},
+  {nullptr, 4, {0x000008, 0x000010, 0x000020, CRGB::White}},
+  {nullptr, 3, {0xFF007F, CRGB::Black, CRGB::OrangeRed}}
+};
+
+CRGBPalette16 currentPalette(RainbowColors_p); // global palette storage
+CRGBPalette16 currentOverlayPalette(RainbowColors_p); // global palette storage
+uint8_t nextPalette = PALETTE_RAINBOW; // palettes to blend toward
+uint8_t nextOverlayPalette = PALETTE_RAINBOW;
+boolean paletteBlending = false; // currentPalette may differ from nextPalette
+boolean overlayPaletteBlending = false;
+
+// currentPalette sampled at the middle of every 8 steps, without brightness
+// scaling: 96 bytes of SRAM
+#define PALETTE_CACHE_SHIFT 3
+CRGB paletteCache[256 >> PALETTE_CACHE_SHIFT];
+boolean paletteCacheOutdated = true;
+
+// Expand a palette from the library
+void loadPalette(CRGBPalette16& palette, uint8_t index) {
+  PaletteDef def;
+  memcpy_P(&def, &PaletteLibrary[index], sizeof(PaletteDef));
+  if (def.fixed) {
+    palette = *def.fixed;
+  } else if (def.stops == 4) {
+    palette = CRGBPalette16(def.colors[0], def.colors[1], def.colors[2], def.colors[3]);
+  } else if (def.stops == 3) {
+    palette = CRGBPalette16(def.colors[0], def.colors[1], def.colors[2]);
+  } else {
+    palette = CRGBPalette16(def.colors[0], def.colors[1]);
+  }
+}
+
+uint8_t getRandomAudioPalette() {
+  return random8(AUDIOPALETTES);
+}
+
+// Switch the main palette at once; it still blends toward nextPalette afterwards
+void selectPalette(uint8_t index) {
+  loadPalette(currentPalette, index);
+  paletteBlending = true;
+  paletteCacheOutdated = true;
+}
+
+// Pick a random palette from a list
+void selectRandomAudioPalette() {
+  selectPalette(getRandomAudioPalette());
+}
+
+void selectRandomOverlayAudioPalette() {
+  loadPalette(currentOverlayPalette, getRandomAudioPalette());
+  overlayPaletteBlending = true;
+}
+
+void selectRandomNoisePalette() {
+  selectPalette(NOISEPALETTE_FIRST + random8(NOISEPALETTES));
+}
+
+// Start blending toward new palettes
+void blendToPalettes(uint8_t index, uint8_t overlayIndex) {
+  nextPalette = index;
+  nextOverlayPalette = overlayIndex;
+  paletteBlending = true;
+  overlayPaletteBlending = true;
+}
+
+// One step toward the target; returns false once the palette has arrived
+boolean blendPaletteStep(CRGBPalette16& palette, uint8_t target) {
+  CRGBPalette16 targetPalette;
+  loadPalette(targetPalette, target);
+  nblendPaletteTowardPalette(palette, targetPalette, 80);
+  return palette != targetPalette;
+}
+
+void blendPalettes() {
+  if (paletteBlending) {
+    paletteBlending = blendPaletteStep(currentPalette, nextPalette);
+    paletteCacheOutdated = true;
+  }
+  if (overlayPaletteBlending) {
+    overlayPaletteBlending = blendPaletteStep(currentOverlayPalette, nextOverlayPalette);
+  }
+}
+
+void updatePaletteCache() {
+  if (!paletteCacheOutdated) return;
+  paletteCacheOutdated = false;
+  for (uint16_t i = 0; i < 256; i += 1 << PALETTE_CACHE_SHIFT) {
+    paletteCache[i >> PALETTE_CACHE_SHIFT] = ColorFromPalette(currentPalette, i + (1 << PALETTE_CACHE_SHIFT) / 2);
+  }
+}
+
+// ColorFromPalette(currentPalette, index, brightness) from the cache
+CRGB paletteColor(uint8_t index, uint8_t brightness = 255) {
+  CRGB color = paletteCache[index >> PALETTE_CACHE_SHIFT];
+  if (brightness != 255) {
+    if (brightness) {
+      ++brightness; // adjust for rounding, as ColorFromPalette does
+      if (color.red) color.red = scale8(color.red, brightness);
+      if (color.green) color.green = scale8(color.green, brightness);
+      if (color.blue) color.blue = scale8(color.blue, brightness);
+    } else {
+      color = CRGB::Black;
+    }
+  }
+  return color;
+}
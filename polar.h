@@ -0,0 +1,105 @@
+// Polar coordinates of the visible pixels, generated at compile time
+//
+// PolarTable<CenterX2, CenterY2> holds, for every visible LED index, the
+// angle and distance of that pixel's centre from (CenterX2 / 2, CenterY2 / 2)
+// in grid coordinates, so half-pixel centres like the bridge of the nose work:
+//   angle     0-255 for a full turn, 0 pointing right (+x) and 64 down (+y)
+//   distance  pixels in Q4.4 (1/16 pixel), saturating at 255
+// Both tables live in PROGMEM; read them with pgm_read_byte(). The constexpr
+// helpers below only run in the compiler, so their float math never reaches
+// the AVR.
+
+constexpr uint8_t polarGridCell(uint8_t led, uint8_t cell = 0) {
+  return cell >= NUM_LEDS || ShadesTable[cell] == led ? cell : polarGridCell(led, cell + 1);
+}
+
+constexpr double polarSqrt(double v, double guess = 1, uint8_t steps = 24) {
+  return steps == 0 ? guess : polarSqrt(v, (guess + v / guess) / 2, steps - 1);
+}
+
+// atan(t) for |t| <= 0.2 by its power series
+constexpr double polarAtanSeries(double term, double t2, uint8_t n = 0) {
+  return n == 10 ? 0 : term / (2 * n + 1) + polarAtanSeries(-term * t2, t2, n + 1);
+}
+
+// atan(t) for |t| <= 1: two half-angle steps bring t under tan(pi/16)
+constexpr double polarAtanHalf(double t) {
+  return t / (1 + polarSqrt(1 + t * t));
+}
+
+constexpr double polarAtanReduced(double h) {
+  return 4 * polarAtanSeries(h, h * h);
+}
+
+constexpr double polarAtan(double t) {
+  return polarAtanReduced(polarAtanHalf(polarAtanHalf(t)));
+}
+
+constexpr double polarAbs(double v) {
+  return v < 0 ? -v : v;
+}
+
+// atan2 in (-pi, pi]
+constexpr double polarAtan2(double y, double x) {
+  return x == 0 && y == 0 ? 0 :
+         polarAbs(y) <= polarAbs(x) ? polarAtan(y / x) + (x > 0 ? 0 : y >= 0 ? PI : -PI) :
+         (y > 0 ? PI / 2 : -PI / 2) - polarAtan(x / y);
+}
+
+constexpr uint8_t polarAngle8(double angle) {
+  return (int)(angle * 128 / PI + (angle >= 0 ? 0.5 : -0.5)) & 0xFF;
+}
+
+constexpr uint8_t polarQ4(double distance) {
+  return distance * 16 + 0.5 >= 255 ? 255 : (uint8_t)(distance * 16 + 0.5);
+}
+
+// Offsets from the centre in half pixels
+constexpr int polarDX2(uint8_t led, int centerX2) {
+  return 2 * (polarGridCell(led) % kMatrixWidth) - centerX2;
+}
+
+constexpr int polarDY2(uint8_t led, int centerY2) {
+  return 2 * (polarGridCell(led) / kMatrixWidth) - centerY2;
+}
+
+constexpr uint8_t polarAngleOf(uint8_t led, int centerX2, int centerY2) {
+  return polarAngle8(polarAtan2(polarDY2(led, centerY2), polarDX2(led, centerX2)));
+}
+
+constexpr uint8_t polarDistanceOf(uint8_t led, int centerX2, int centerY2) {
+  return polarQ4(polarSqrt(polarDX2(led, centerX2) * polarDX2(led, centerX2) +
+                           polarDY2(led, centerY2) * polarDY2(led, centerY2)) / 2);
+}
+
+// Forces each entry to be evaluated by the compiler
+template <uint8_t Value> struct PolarByte {
+  static const uint8_t value = Value;
+};
+
+template <uint8_t... Leds> struct PolarLeds {};
+
+template <uint8_t N, uint8_t... Leds> struct MakePolarLeds : MakePolarLeds<N - 1, N - 1, Leds...> {};
+
+template <uint8_t... Leds> struct MakePolarLeds<0, Leds...> {
+  typedef PolarLeds<Leds...> type;
+};
+
+template <int CenterX2, int CenterY2, typename Leds = typename MakePolarLeds<LAST_VISIBLE_LED + 1>::type>
+struct PolarTable;
+
+template <int CenterX2, int CenterY2, uint8_t... Leds>
+struct PolarTable<CenterX2, CenterY2, PolarLeds<Leds...> > {
+  static const uint8_t angle[sizeof...(Leds)];
+  static const uint8_t distance[sizeof...(Leds)];
+};
+
+template <int CenterX2, int CenterY2, uint8_t... Leds>
+const uint8_t PolarTable<CenterX2, CenterY2, PolarLeds<Leds...> >::angle[sizeof...(Leds)] PROGMEM = {
+  PolarByte<polarAngleOf(Leds, CenterX2, CenterY2)>::value...
+};
+
+template <int CenterX2, int CenterY2, uint8_t... Leds>
+const uint8_t PolarTable<CenterX2, CenterY2, PolarLeds<Leds...> >::distance[sizeof...(Leds)] PROGMEM = {
+  PolarByte<polarDistanceOf(Leds, CenterX2, CenterY2)>::value...
+};
@@ -0,0 +1,117 @@
+// Profiling markers around the stages of loop()
+//
+// Build with -DPROFILE_CYCLES for the simavr benchmark in host/avr: each marker
+// is a single OUT to GPIOR0, which the simulator timestamps with its cycle counter.
+//
+// Build with -DPROFILE_STAGES to time the stages on the device itself: each
+// marker pair takes two micros() stamps and counts the duration in a log2
+// histogram per stage, and every effect keeps its longest run and the longest
+// loop() pass it was active for. Send 'p' over Serial for a dump (which also
+// clears the statistics), e.g. to find the effect that pushes loop() past
+// AUDIODELAY.
+//
+// Otherwise the markers compile out. Effects are marked as PROFILE_EFFECT +
+// their index in the Effects registry.
+
+#define PROFILE_AUDIO    0x01
+#define PROFILE_OUTPUT   0x02
+#define PROFILE_SHOW     0x03
+#define PROFILE_DRAWRING 0x04
+#define PROFILE_BUTTONS  0x05
+#define PROFILE_EEPROM   0x06
+#define PROFILE_PALETTE  0x07
+#define PROFILE_LOOP     0x08
+#define PROFILE_EFFECT   0x10
+
+#if defined(PROFILE_CYCLES) && defined(GPIOR0)
+
+#define PROFILE_BEGIN(id) (GPIOR0 = (id))
+#define PROFILE_END(id)   (GPIOR0 = (id) | 0x80)
+#define PROFILE_POLL()    do { } while (0)
+
+#elif defined(PROFILE_STAGES)
+
+#define PROFILE_STAGE_COUNT 9 // stage 0 is the effect, then PROFILE_AUDIO..PROFILE_LOOP
+#define PROFILE_BUCKETS 12    // under 16 us, then doubling ranges, the last open-ended
+#define PROFILE_MAX_EFFECTS 16
+
+const char profileStageNames[PROFILE_STAGE_COUNT][9] PROGMEM = {
+  "effect", "audio", "output", "show", "drawRing", "buttons", "eeprom", "palette", "loop"
+};
+
+uint32_t profileStart[PROFILE_STAGE_COUNT];
+uint16_t profileHistogram[PROFILE_STAGE_COUNT][PROFILE_BUCKETS];
+uint16_t profileEffectMax[PROFILE_MAX_EFFECTS];
+uint16_t profileEffectLoopMax[PROFILE_MAX_EFFECTS];
+byte profileEffect = 0; // effect that ran most recently
+
+byte profileStage(byte id) {
+  return id >= PROFILE_EFFECT ? 0 : id;
+}
+
+void profileBegin(byte id) {
+  if (id >= PROFILE_EFFECT) profileEffect = (id - PROFILE_EFFECT) % PROFILE_MAX_EFFECTS;
+  profileStart[profileStage(id)] = micros();
+}
+
+void profileEnd(byte id) {
+  byte stage = profileStage(id);
+  uint32_t elapsed = micros() - profileStart[stage];
+  uint16_t clamped = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+
+  byte bucket = 0;
+  for (uint32_t bound = 16; elapsed >= bound && bucket < PROFILE_BUCKETS - 1; bound <<= 1) {
+    bucket++;
+  }
+  if (profileHistogram[stage][bucket] < 0xFFFF) profileHistogram[stage][bucket]++;
+
+  if (stage == 0 && clamped > profileEffectMax[profileEffect]) profileEffectMax[profileEffect] = clamped;
+  if (id == PROFILE_LOOP && clamped > profileEffectLoopMax[profileEffect]) profileEffectLoopMax[profileEffect] = clamped;
+}
+
+// Print the statistics as text and start over; blocks on Serial, so only on request
+void profileDump() {
+  Serial.print(F("stage    "));
+  for (byte b = 0; b < PROFILE_BUCKETS - 1; b++) {
+    Serial.print(F(" <"));
+    Serial.print(16UL << b);
+  }
+  Serial.print(F(" >="));
+  Serial.print(16UL << (PROFILE_BUCKETS - 2));
+  Serial.println();
+  for (byte s = 0; s < PROFILE_STAGE_COUNT; s++) {
+    char name[9];
+    strcpy_P(name, profileStageNames[s]);
+    Serial.print(name);
+    for (byte b = 0; b < PROFILE_BUCKETS; b++) {
+      Serial.print(' ');
+      Serial.print(profileHistogram[s][b]);
+    }
+    Serial.println();
+  }
+  for (byte e = 0; e < PROFILE_MAX_EFFECTS; e++) {
+    if (profileEffectLoopMax[e] == 0) continue;
+    Serial.print(F("effect"));
+    Serial.print(e);
+    Serial.print(F(" max us "));
+    Serial.print(profileEffectMax[e]);
+    Serial.print(F(" loop max us "));
+    Serial.println(profileEffectLoopMax[e]);
+  }
+
+  memset(profileHistogram, 0, sizeof(profileHistogram));
+  memset(profileEffectMax, 0, sizeof(profileEffectMax));
+  memset(profileEffectLoopMax, 0, sizeof(profileEffectLoopMax));
+}
+
+#define PROFILE_BEGIN(id) profileBegin(id)
+#define PROFILE_END(id)   profileEnd(id)
+#define PROFILE_POLL()    do { if (Serial.available() && Serial.read() == 'p') profileDump(); } while (0)
+
+#else
+
+#define PROFILE_BEGIN(id)
+#define PROFILE_END(id)
+#define PROFILE_POLL()    do { } while (0)
+
+#endif
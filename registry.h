@@ -0,0 +1,121 @@
+// Effect interface and registry
+//
+// An effect is a struct with static hooks and a nested State:
+//
+//   struct Rider : Effect {
+//     struct State { byte pos; };
+//     static void init(State& s);               // once each time the effect is selected
+//     static void render(State& s);             // draw one frame into leds[]
+//     static uint16_t interval(const State& s); // ms until the next render
+//   };
+//
+// Effects keep no statics of their own. Only the running effect's State
+// exists, in an arena shared by all effects and sized at compile time to the
+// largest; it is zeroed before init() on every switch. Effects without state
+// can use the empty Effect::State.
+//
+// A symmetric effect sets symmetry (see XYmap.h) and renders only the pixels
+// of symmetricPixels(symmetry); the registry mirrors them onto the rest of the
+// frame.
+//
+// overlay(), if an effect has one, runs once per frame period independently of
+// render(). It draws with setOverlayPixel() onto the overlay layer (output.h),
+// which the registry clears first, so beat markers can move without the base
+// effect being redrawn.
+//
+// The list of effects is a type, EffectRegistry<AudioShadesOutline, Rider, ...>,
+// which builds the dispatch table for its effects and owns the arena.
+//
+// When start() switches from a running effect it begins a crossfade
+// (output.h) from the last frame shown.
+
+struct Effect {
+  struct State {};
+  static const uint8_t symmetry = SYMMETRY_NONE;
+  template <typename S> static void overlay(S& s) {}
+};
+
+// Type-erased hooks of one effect
+struct EffectEntry {
+  void (*init)(void* state);
+  void (*render)(void* state);
+  void (*overlay)(void* state);
+  uint16_t (*interval)(const void* state);
+  uint8_t symmetry;
+};
+
+template <typename E> void initEffect(void* state) {
+  E::init(*static_cast<typename E::State*>(state));
+}
+
+template <typename E> void renderEffect(void* state) {
+  E::render(*static_cast<typename E::State*>(state));
+}
+
+template <typename E> void overlayEffect(void* state) {
+  E::overlay(*static_cast<typename E::State*>(state));
+}
+
+template <typename E> uint16_t effectInterval(const void* state) {
+  return E::interval(*static_cast<const typename E::State*>(state));
+}
+
+// Largest of a list of sizes
+template <size_t... Sizes> struct EffectMax;
+
+template <size_t Size> struct EffectMax<Size> {
+  static const size_t value = Size;
+};
+
+template <size_t First, size_t... Rest> struct EffectMax<First, Rest...> {
+  static const size_t value = First > EffectMax<Rest...>::value ? First : EffectMax<Rest...>::value;
+};
+
+template <typename... Effects> struct EffectRegistry {
+  static const byte count = sizeof...(Effects);
+  static const size_t stateSize = EffectMax<sizeof(typename Effects::State)...>::value;
+
+  struct Arena {
+    alignas(EffectMax<alignof(typename Effects::State)...>::value) uint8_t bytes[stateSize];
+  };
+
+  static Arena arena;
+  static EffectEntry entries[sizeof...(Effects)]; // not const: host/sim.cpp times the render hooks
+
+  static boolean started; // an effect is running from arena
+
+  // Reset the shared state and initialize the effect at index
+  static void start(byte index) {
+    if (CROSSFADEFRAMES > 0 && started) beginCrossfade();
+    started = true;
+    memset(arena.bytes, 0, stateSize);
+    resetOverlay();
+    entries[index].init(arena.bytes);
+  }
+
+  static void render(byte index) {
+    entries[index].render(arena.bytes);
+    mirrorPixels(entries[index].symmetry);
+  }
+
+  // Redraw the overlay layer
+  static void overlay(byte index) {
+    clearOverlay();
+    entries[index].overlay(arena.bytes);
+  }
+
+  static uint16_t interval(byte index) {
+    return entries[index].interval(arena.bytes);
+  }
+};
+
+template <typename... Effects>
+typename EffectRegistry<Effects...>::Arena EffectRegistry<Effects...>::arena;
+
+template <typename... Effects>
+boolean EffectRegistry<Effects...>::started = false;
+
+template <typename... Effects>
+EffectEntry EffectRegistry<Effects...>::entries[sizeof...(Effects)] = {
+  { initEffect<Effects>, renderEffect<Effects>, overlayEffect<Effects>, effectInterval<Effects>, Effects::symmetry }...
+};
@@ -0,0 +1,140 @@
+// Settings log in EEPROM
+//
+// Each save appends a SETTINGSRECORDSIZE-byte record to the slot after the
+// newest one, round the whole EEPROM, so a cell is rewritten only once every
+// SETTINGSSLOTS saves. Records carry a sequence number and a CRC8. At boot
+// loadSettings() reads every slot once and restores the newest record that
+// checks out; one torn by a power cut fails its CRC and the one before it is
+// used instead.
+//
+// Besides the user's choices, a record keeps what the audio analysis has
+// learned, the AGC level and the last confident tempo, so the shades start
+// tuned to the room instead of from AGCTARGET with no tempo. As that changes
+// all the time it is saved every SETTINGSAUDIOSAVEMILLIS; button changes are
+// saved EEPROMDELAY after the last press, as before. effectParams[] holds a
+// byte per registry index for effects to keep a setting in.
+//
+// A record goes out one byte per loop() pass, each once the EEPROM has
+// finished the one before, so saving never holds up the loop.
+
+#define SETTINGSVERSION 1
+#define SETTINGSRECORDSIZE 32
+#define SETTINGSSLOTS (1024 / SETTINGSRECORDSIZE) // the ATmega328 has 1 KB of EEPROM
+#define SETTINGSEFFECTS 16
+#define SETTINGSAUDIOSAVEMILLIS 600000UL // 10 minutes: 100,000 writes per cell last 60 years
+
+// Settings saved at fixed addresses before the log, marked with 99 at address 0
+#define SETTINGSLEGACYMARKER 99
+
+// Record flags
+#define SETTINGSAUTOCYCLE 0x01
+#define SETTINGSAUDIO 0x02
+
+// 16-bit fields first, so neither the AVR nor the host compiler pads it
+struct SettingsRecord {
+  uint16_t sequence;       // one more than the record before, wrapping
+  uint16_t audioAvg;       // AGC average band level, integer part
+  uint16_t millisPerBeat;  // last confident tempo, 0 for none
+  uint8_t version;         // SETTINGSVERSION
+  uint8_t effect;          // currentEffect
+  uint8_t flags;           // SETTINGSAUTOCYCLE, SETTINGSAUDIO
+  uint8_t brightness;      // currentBrightness
+  uint8_t tempoConfidence; // of millisPerBeat
+  uint8_t effectParams[SETTINGSEFFECTS];
+  uint8_t reserved[4];
+  uint8_t crc;             // CRC8 of every byte before it
+};
+
+static_assert(sizeof(SettingsRecord) == SETTINGSRECORDSIZE, "SettingsRecord must fill its slot exactly");
+
+uint8_t effectParams[SETTINGSEFFECTS]; // per registry index, saved with the settings
+SettingsRecord settingsRecord; // the newest record, or the one being written
+byte settingsSlot = SETTINGSSLOTS - 1; // slot of settingsRecord
+byte settingsWritePos = SETTINGSRECORDSIZE; // next byte of settingsRecord to write
+uint32_t settingsSavedMillis = 0; // time of the last save
+
+boolean readSettingsSlot(byte slot, SettingsRecord& record) {
+  EEPROM.get(slot * SETTINGSRECORDSIZE, record);
+  return record.version == SETTINGSVERSION && crc8((const uint8_t*)&record, SETTINGSRECORDSIZE - 1) == record.crc;
+}
+
+// Restore the newest valid record, or else the settings of the old fixed layout
+void loadSettings() {
+  boolean found = false;
+  for (byte slot = 0; slot < SETTINGSSLOTS; slot++) {
+    SettingsRecord record;
+    if (!readSettingsSlot(slot, record)) continue;
+    if (!found || (int16_t)(record.sequence - settingsRecord.sequence) > 0) {
+      settingsRecord = record;
+      settingsSlot = slot;
+      found = true;
+    }
+  }
+
+  if (found) {
+    currentEffect = settingsRecord.effect;
+    autoCycle = settingsRecord.flags & SETTINGSAUTOCYCLE;
+    audioEnabled = settingsRecord.flags & SETTINGSAUDIO;
+    currentBrightness = settingsRecord.brightness;
+    memcpy(effectParams, settingsRecord.effectParams, sizeof(effectParams));
+    if (settingsRecord.audioAvg) {
+      audioAvgQ16 = (uint32_t)settingsRecord.audioAvg << 16;
+      updateGainAGC();
+    }
+    seedTempo(settingsRecord.millisPerBeat, settingsRecord.tempoConfidence);
+  } else if (EEPROM.read(0) == SETTINGSLEGACYMARKER) {
+    // the first save goes to slot 0 and replaces them
+    currentEffect = EEPROM.read(1);
+    autoCycle = EEPROM.read(2);
+    currentBrightness = EEPROM.read(3);
+    audioEnabled = EEPROM.read(4);
+  }
+
+  if (currentBrightness >= BRIGHTNESSLEVELS) currentBrightness = BOOTBRIGHTNESS;
+}
+
+// Start writing the current settings to the next slot
+void saveSettings() {
+  // a record still being written is restarted in its slot with the newer settings
+  if (settingsWritePos >= SETTINGSRECORDSIZE) settingsSlot = (settingsSlot + 1) % SETTINGSSLOTS;
+
+  settingsRecord.sequence++;
+  settingsRecord.version = SETTINGSVERSION;
+  settingsRecord.effect = currentEffect;
+  settingsRecord.flags = (autoCycle ? SETTINGSAUTOCYCLE : 0) | (audioEnabled ? SETTINGSAUDIO : 0);
+  settingsRecord.brightness = currentBrightness;
+  settingsRecord.audioAvg = audioAvgQ16 >> 16;
+  if (millisPerBeat) { // keep the last tempo through breaks in the music
+    settingsRecord.millisPerBeat = millisPerBeat;
+    settingsRecord.tempoConfidence = tempoConfidence;
+  }
+  memcpy(settingsRecord.effectParams, effectParams, sizeof(effectParams));
+  settingsRecord.crc = crc8((const uint8_t*)&settingsRecord, SETTINGSRECORDSIZE - 1);
+
+  settingsWritePos = 0;
+  settingsSavedMillis = currentMillis;
+}
+
+// Write the next changed byte of the record in progress, if the EEPROM is ready for it
+void writeSettingsStep() {
+  while (settingsWritePos < SETTINGSRECORDSIZE && eeprom_is_ready()) {
+    int address = settingsSlot * SETTINGSRECORDSIZE + settingsWritePos;
+    byte value = ((const uint8_t*)&settingsRecord)[settingsWritePos++];
+    if (EEPROM.read(address) != value) {
+      EEPROM.write(address, value);
+      return;
+    }
+  }
+}
+
+// Save settings once they have settled after a change, and the learned audio
+// state now and then; write out any record in progress
+void checkEEPROM() {
+  if (eepromOutdated && currentMillis - eepromMillis > EEPROMDELAY) {
+    eepromOutdated = false;
+    saveSettings();
+  } else if (currentMillis - settingsSavedMillis > SETTINGSAUDIOSAVEMILLIS) {
+    saveSettings();
+  }
+  writeSettingsStep();
+}
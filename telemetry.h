@@ -0,0 +1,204 @@
+// Binary telemetry over Serial, decoded on the host with rave_sim --decode
+//
+// Build with -DTELEMETRY_LEVEL=TELEMETRY_INFO for a status and a timing record
+// every TELEMETRY_INTERVAL ms, or TELEMETRY_DEBUG to add a record for every audio
+// tick with an onset. At TELEMETRY_OFF (the default) every hook compiles out.
+//
+// Records are queued in a small ring and drained a whole record at a time when
+// the Serial TX buffer has room, so loop() never waits on the UART. A full ring
+// drops the new record; the shared sequence number still advances so the
+// decoder sees the gap. Trace records and headers (trace.h) may be
+// interleaved; each format resyncs on its own sync byte plus a valid CRC.
+//
+// Record layout (TELEMETRY_RECORD_SIZE bytes, little endian):
+//   [0]      TELEMETRY_SYNC
+//   [1]      record type
+//   [2]      sequence number
+//   [3..6]   currentMillis
+//   [7..14]  payload
+//   [15]     crc8() of bytes 1..14
+//
+// Payloads:
+//   TELEMETRY_STATUS  uint16 millisPerBeat, uint8 tempoConfidence, uint16 gain (Q8.8),
+//                     uint8 kick, snare and hat onsets since the last status (saturating)
+//   TELEMETRY_TIMING  uint16 longest loop() pass in us, uint16 mean pass in us,
+//                     uint16 passes, uint8 audio ticks, uint8 records dropped (both saturating)
+//   TELEMETRY_ONSET   uint8 onset flags, uint8 beat phase, uint8 beat counter,
+//                     uint16 gained bass level, uint16 sampler overruns, 1 byte unused
+
+#define TELEMETRY_OFF 0
+#define TELEMETRY_INFO 1
+#define TELEMETRY_DEBUG 2
+
+#ifndef TELEMETRY_LEVEL
+#define TELEMETRY_LEVEL TELEMETRY_OFF
+#endif
+
+#define TELEMETRY_SYNC 0x5A
+#define TELEMETRY_RECORD_SIZE 16
+
+static_assert(TELEMETRY_SYNC != TRACE_SYNC && TELEMETRY_SYNC != TRACE_HEADER_SYNC,
+              "telemetry and trace records share the Serial stream and need their own sync bytes");
+#define TELEMETRY_PAYLOAD_SIZE 8
+
+#define TELEMETRY_STATUS 1
+#define TELEMETRY_TIMING 2
+#define TELEMETRY_ONSET 3
+
+struct TelemetryRecord {
+  uint8_t type;
+  uint8_t sequence;
+  uint32_t millis;
+  uint8_t payload[TELEMETRY_PAYLOAD_SIZE];
+};
+
+void telemetryPut16(uint8_t* payload, byte offset, uint16_t value) {
+  payload[offset] = value;
+  payload[offset + 1] = value >> 8;
+}
+
+uint16_t telemetryGet16(const uint8_t* payload, byte offset) {
+  return payload[offset] | (payload[offset + 1] << 8);
+}
+
+void telemetryEncode(const TelemetryRecord& record, uint8_t* out) {
+  out[0] = TELEMETRY_SYNC;
+  out[1] = record.type;
+  out[2] = record.sequence;
+  for (byte i = 0; i < 4; i++) {
+    out[3 + i] = record.millis >> (8 * i);
+  }
+  memcpy(out + 7, record.payload, TELEMETRY_PAYLOAD_SIZE);
+  out[TELEMETRY_RECORD_SIZE - 1] = crc8(out + 1, TELEMETRY_RECORD_SIZE - 2);
+}
+
+// Returns false if the bytes don't hold a valid record
+boolean telemetryDecode(const uint8_t* in, TelemetryRecord& record) {
+  if (in[0] != TELEMETRY_SYNC || crc8(in + 1, TELEMETRY_RECORD_SIZE - 2) != in[TELEMETRY_RECORD_SIZE - 1]) {
+    return false;
+  }
+
+  record.type = in[1];
+  record.sequence = in[2];
+  record.millis = 0;
+  for (byte i = 0; i < 4; i++) {
+    record.millis |= (uint32_t)in[3 + i] << (8 * i);
+  }
+  memcpy(record.payload, in + 7, TELEMETRY_PAYLOAD_SIZE);
+  return true;
+}
+
+#if TELEMETRY_LEVEL > TELEMETRY_OFF
+
+#define TELEMETRY_INTERVAL 1000 // ms between status and timing records
+#define TELEMETRY_RING 4        // queued records, a power of two
+
+uint8_t telemetryRing[TELEMETRY_RING][TELEMETRY_RECORD_SIZE];
+byte telemetryHead = 0; // next record to send
+byte telemetryQueued = 0;
+uint8_t telemetrySequence = 0;
+uint8_t telemetryDropped = 0;
+
+// Interval statistics
+uint32_t telemetryMillis = 0;
+uint32_t telemetryPassMicros = 0;
+uint16_t telemetryLongestPass = 0;
+uint32_t telemetryPassTotal = 0;
+uint16_t telemetryPasses = 0;
+uint8_t telemetryAudioTicks = 0;
+uint8_t telemetryOnsetCounts[3] = {0, 0, 0};
+
+void telemetryPush(uint8_t type, const uint8_t* payload) {
+  TelemetryRecord record;
+  record.type = type;
+  record.sequence = telemetrySequence++;
+  record.millis = currentMillis;
+  memcpy(record.payload, payload, TELEMETRY_PAYLOAD_SIZE);
+
+  if (telemetryQueued == TELEMETRY_RING) {
+    if (telemetryDropped < 255) telemetryDropped++;
+    return;
+  }
+  telemetryEncode(record, telemetryRing[(telemetryHead + telemetryQueued) & (TELEMETRY_RING - 1)]);
+  telemetryQueued++;
+}
+
+// Send whole queued records while the TX buffer can take them without blocking
+void telemetryDrain() {
+  while (telemetryQueued > 0 && Serial.availableForWrite() >= TELEMETRY_RECORD_SIZE) {
+    Serial.write(telemetryRing[telemetryHead], TELEMETRY_RECORD_SIZE);
+    telemetryHead = (telemetryHead + 1) & (TELEMETRY_RING - 1);
+    telemetryQueued--;
+  }
+}
+
+// Once per loop() pass: time the previous pass, emit the interval records, drain
+void telemetryTick(uint16_t beatMillis, uint8_t confidence, uint16_t gainQ8) {
+  uint32_t now = micros();
+  if (telemetryPasses < 0xFFFF && telemetryPassMicros != 0) {
+    uint32_t pass = now - telemetryPassMicros;
+    telemetryLongestPass = std::max(telemetryLongestPass, (uint16_t)std::min(pass, (uint32_t)0xFFFF));
+    telemetryPassTotal += pass;
+    telemetryPasses++;
+  }
+  telemetryPassMicros = now;
+
+  if (currentMillis - telemetryMillis >= TELEMETRY_INTERVAL) {
+    telemetryMillis = currentMillis;
+    uint8_t payload[TELEMETRY_PAYLOAD_SIZE] = {0};
+
+    telemetryPut16(payload, 0, beatMillis);
+    payload[2] = confidence;
+    telemetryPut16(payload, 3, gainQ8);
+    memcpy(payload + 5, telemetryOnsetCounts, 3);
+    telemetryPush(TELEMETRY_STATUS, payload);
+
+    telemetryPut16(payload, 0, telemetryLongestPass);
+    telemetryPut16(payload, 2, telemetryPasses ? telemetryPassTotal / telemetryPasses : 0);
+    telemetryPut16(payload, 4, telemetryPasses);
+    payload[6] = telemetryAudioTicks;
+    payload[7] = telemetryDropped;
+    telemetryPush(TELEMETRY_TIMING, payload);
+
+    telemetryLongestPass = 0;
+    telemetryPassTotal = 0;
+    telemetryPasses = 0;
+    telemetryAudioTicks = 0;
+    telemetryDropped = 0;
+    memset(telemetryOnsetCounts, 0, 3);
+  }
+
+  telemetryDrain();
+}
+
+// Once per audio tick, after onset detection
+void telemetryAudio(uint8_t flags, uint8_t phase, uint8_t counter, uint16_t bass, uint16_t overruns) {
+  if (telemetryAudioTicks < 255) telemetryAudioTicks++;
+  for (byte i = 0; i < 3; i++) {
+    if ((flags & (1 << i)) && telemetryOnsetCounts[i] < 255) telemetryOnsetCounts[i]++;
+  }
+
+#if TELEMETRY_LEVEL >= TELEMETRY_DEBUG
+  if (flags) {
+    uint8_t payload[TELEMETRY_PAYLOAD_SIZE] = {0};
+    payload[0] = flags;
+    payload[1] = phase;
+    payload[2] = counter;
+    telemetryPut16(payload, 3, bass);
+    telemetryPut16(payload, 5, overruns);
+    telemetryPush(TELEMETRY_ONSET, payload);
+  }
+#endif
+}
+
+// Expanded in loop() and doAnalogs(), where these globals are in scope
+#define TELEMETRY_TICK() telemetryTick(millisPerBeat, tempoConfidence, gainAGCQ8)
+#define TELEMETRY_AUDIO() \
+  telemetryAudio(onsetFlags, beatPhaseQ24 >> 16, beatCounter, std::min(spectrumValue[1], 0xFFFFU), eqOverruns)
+
+#else
+
+#define TELEMETRY_TICK()
+#define TELEMETRY_AUDIO()
+
+#endif
@@ -0,0 +1,173 @@
+// Binary trace of the audio and button inputs, for deterministic replay on the host
+//
+// Build with -DTRACE_INPUT to stream one record per doAnalogs() tick over Serial.
+// A record is dropped rather than blocking loop() when the TX buffer can't take it
+// whole; the sequence number still advances so the replayer can see the gap.
+// Text from Serial.print debugging may be interleaved, the reader resyncs on
+// TRACE_SYNC plus a valid CRC.
+//
+// Record layout (TRACE_RECORD_SIZE bytes, little endian):
+//   [0]      TRACE_SYNC
+//   [1]      sequence number
+//   [2..5]   currentMillis at the tick
+//   [6..14]  7 x 10-bit averaged ADC readings, band 0 first, packed LSB first,
+//            followed by the MODEBUTTON and BRIGHTNESSBUTTON pin levels (1 bit each)
+//   [15]     crc8() of bytes 1..14
+//
+// The ADC readings are captured before noise floor, correction and gain, so
+// replaying them through analogRead() reproduces every later stage exactly.
+//
+// setup() first sends a header record, of the same size, with the audio state
+// loadSettings() restored (settings.h), so a replay starts from it too:
+//   [0]      TRACE_HEADER_SYNC
+//   [1..2]   sequence number of the settings record restored (0 if none was)
+//   [3..6]   audioAvgQ16, the AGC average
+//   [7..8]   millisPerBeat
+//   [9]      tempoConfidence
+//   [10..14] 0
+//   [15]     crc8() of bytes 1..14
+
+#define TRACE_SYNC 0xA5
+#define TRACE_HEADER_SYNC 0xC3
+#define TRACE_RECORD_SIZE 16
+
+struct TraceRecord {
+  uint8_t sequence;
+  uint32_t millis;
+  uint16_t samples[7];
+  uint8_t modeButton;
+  uint8_t brightnessButton;
+};
+
+struct TraceHeader {
+  uint16_t settingsSequence;
+  uint32_t audioAvgQ16;
+  uint16_t millisPerBeat;
+  uint8_t tempoConfidence;
+};
+
+void traceEncode(const TraceRecord& record, uint8_t* out) {
+  out[0] = TRACE_SYNC;
+  out[1] = record.sequence;
+  for (byte i = 0; i < 4; i++) {
+    out[2 + i] = record.millis >> (8 * i);
+  }
+
+  uint32_t bits = 0;
+  byte bitCount = 0;
+  byte n = 6;
+  for (byte i = 0; i < 7; i++) {
+    bits |= (uint32_t)(record.samples[i] & 0x3FF) << bitCount;
+    bitCount += 10;
+    while (bitCount >= 8) {
+      out[n++] = bits;
+      bits >>= 8;
+      bitCount -= 8;
+    }
+  }
+  bits |= (uint32_t)(record.modeButton & 1) << bitCount++;
+  bits |= (uint32_t)(record.brightnessButton & 1) << bitCount++;
+  out[n++] = bits;
+
+  out[n] = crc8(out + 1, TRACE_RECORD_SIZE - 2);
+}
+
+// Returns false if the bytes don't hold a valid record
+boolean traceDecode(const uint8_t* in, TraceRecord& record) {
+  if (in[0] != TRACE_SYNC || crc8(in + 1, TRACE_RECORD_SIZE - 2) != in[TRACE_RECORD_SIZE - 1]) {
+    return false;
+  }
+
+  record.sequence = in[1];
+  record.millis = 0;
+  for (byte i = 0; i < 4; i++) {
+    record.millis |= (uint32_t)in[2 + i] << (8 * i);
+  }
+
+  uint32_t bits = 0;
+  byte bitCount = 0;
+  byte n = 6;
+  for (byte i = 0; i < 7; i++) {
+    while (bitCount < 10) {
+      bits |= (uint32_t)in[n++] << bitCount;
+      bitCount += 8;
+    }
+    record.samples[i] = bits & 0x3FF;
+    bits >>= 10;
+    bitCount -= 10;
+  }
+  record.modeButton = bits & 1;
+  record.brightnessButton = (bits >> 1) & 1;
+  return true;
+}
+
+void traceEncodeHeader(const TraceHeader& header, uint8_t* out) {
+  memset(out, 0, TRACE_RECORD_SIZE);
+  out[0] = TRACE_HEADER_SYNC;
+  out[1] = header.settingsSequence;
+  out[2] = header.settingsSequence >> 8;
+  for (byte i = 0; i < 4; i++) {
+    out[3 + i] = header.audioAvgQ16 >> (8 * i);
+  }
+  out[7] = header.millisPerBeat;
+  out[8] = header.millisPerBeat >> 8;
+  out[9] = header.tempoConfidence;
+  out[TRACE_RECORD_SIZE - 1] = crc8(out + 1, TRACE_RECORD_SIZE - 2);
+}
+
+// Returns false if the bytes don't hold a valid header
+boolean traceDecodeHeader(const uint8_t* in, TraceHeader& header) {
+  if (in[0] != TRACE_HEADER_SYNC || crc8(in + 1, TRACE_RECORD_SIZE - 2) != in[TRACE_RECORD_SIZE - 1]) {
+    return false;
+  }
+
+  header.settingsSequence = in[1] | (uint16_t)in[2] << 8;
+  header.audioAvgQ16 = 0;
+  for (byte i = 0; i < 4; i++) {
+    header.audioAvgQ16 |= (uint32_t)in[3 + i] << (8 * i);
+  }
+  header.millisPerBeat = in[7] | (uint16_t)in[8] << 8;
+  header.tempoConfidence = in[9];
+  return true;
+}
+
+#ifdef TRACE_INPUT
+
+TraceRecord traceRecord;
+uint16_t traceDropped = 0; // records skipped because Serial was busy
+
+void traceWrite(uint32_t tickMillis, uint8_t modeButton, uint8_t brightnessButton) {
+  traceRecord.millis = tickMillis;
+  traceRecord.modeButton = modeButton;
+  traceRecord.brightnessButton = brightnessButton;
+
+  if (Serial.availableForWrite() >= TRACE_RECORD_SIZE) {
+    uint8_t encoded[TRACE_RECORD_SIZE];
+    traceEncode(traceRecord, encoded);
+    Serial.write(encoded, TRACE_RECORD_SIZE);
+  } else {
+    traceDropped++;
+  }
+  traceRecord.sequence++;
+}
+
+// Once, from setup(): the TX buffer is still empty, so it always goes out whole
+void traceWriteHeader(uint16_t settingsSequence, uint32_t audioAvgQ16, uint16_t millisPerBeat,
+                      uint8_t tempoConfidence) {
+  TraceHeader header = { settingsSequence, audioAvgQ16, millisPerBeat, tempoConfidence };
+  uint8_t encoded[TRACE_RECORD_SIZE];
+  traceEncodeHeader(header, encoded);
+  Serial.write(encoded, TRACE_RECORD_SIZE);
+}
+
+#define TRACE_SAMPLE(band, value) (traceRecord.samples[band] = (value))
+#define TRACE_TICK() traceWrite(currentMillis, digitalRead(MODEBUTTON), digitalRead(BRIGHTNESSBUTTON))
+#define TRACE_HEADER() traceWriteHeader(settingsRecord.sequence, audioAvgQ16, millisPerBeat, tempoConfidence)
+
+#else
+
+#define TRACE_SAMPLE(band, value)
+#define TRACE_TICK()
+#define TRACE_HEADER()
+
+#endif
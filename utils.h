@@ -1,7 +1,7 @@
 // Assorted useful functions and variables
 // Global variables
 boolean effectInit = false; // indicates if a pattern has been recently switched
-uint16_t effectDelay = 0; // time between automatic effect changes
+uint16_t effectDelay = 0; // time until the current effect renders again
 uint32_t effectMillis = 0; // store the time of last effect function run
 uint32_t cycleMillis = 0; // store the time of last effect change
 uint32_t paletteBlendMillis = 0; // store the time of last palette blend
@@ -12,20 +12,41 @@ uint32_t audioMillis; // store time of last audio update
 byte currentEffect = 0; // index to the currently running effect
 boolean autoCycle = true; // flag for automatic effect changes
 boolean eepromOutdated = false; // flag for when EEPROM may need to be updated
-byte currentBrightness = STARTBRIGHTNESS; // 0-255 will be scaled to 0-MAXBRIGHTNESS
+byte currentBrightness = BOOTBRIGHTNESS; // index into brightVals, scaled to 0-MAXBRIGHTNESS
 boolean audioEnabled = true; // flag for running audio patterns
 uint8_t fadeActive = 0;
 
-CircularBuffer<uint32_t, 20> rollingPeaks;
-
-CRGBPalette16 currentPalette(RainbowColors_p); // global palette storage
-CRGBPalette16 nextPalette(RainbowColors_p); // global palette storage
-CRGBPalette16 currentOverlayPalette(RainbowColors_p); // global palette storage
-CRGBPalette16 nextOverlayPalette(RainbowColors_p); // global palette storage
+// Recent kick onsets: the newest as an absolute time and the ones before it as
+// uint16 gaps (saturating at 65535 ms) in a ring, newest gap at peakGapHead
+#define PEAK_GAPS 16 // a power of two; holds PEAK_GAPS + 1 peaks
+uint32_t newestPeakMillis = 0;
+uint16_t peakGaps[PEAK_GAPS];
+byte peakGapHead = 0;
+byte peakCount = 0;
+
+void pushPeak(uint32_t peakMillis) {
+  if (peakCount > 0) {
+    peakGapHead = (peakGapHead + 1) & (PEAK_GAPS - 1);
+    peakGaps[peakGapHead] = std::min(peakMillis - newestPeakMillis, (uint32_t)0xFFFF);
+  }
+  newestPeakMillis = peakMillis;
+  if (peakCount <= PEAK_GAPS) peakCount++;
+}
 
-typedef void (*functionList)(); // definition for list of effect function pointers
-// extern byte numEffects;
+// Gap between the index-th newest peak (0 = newest) and the one before it; index < peakCount - 1
+uint16_t peakGapBefore(byte index) {
+  return peakGaps[(peakGapHead - index) & (PEAK_GAPS - 1)];
+}
 
+// Milliseconds from the most recent peak at or before targetMillis, 0xFFFF if there is none
+uint16_t millisSincePeakBefore(uint32_t targetMillis) {
+  uint32_t peak = newestPeakMillis;
+  for (byte i = 0; i < peakCount; i++) {
+    if ((int32_t)(targetMillis - peak) >= 0) return std::min(targetMillis - peak, (uint32_t)0xFFFF);
+    if (i + 1 < peakCount) peak -= peakGapBefore(i);
+  }
+  return 0xFFFF;
+}
 
 // Increment the global hue value for functions that use it
 byte cycleHue = 0;
@@ -37,41 +58,20 @@ void hueCycle(byte incr) {
 
 // Set every LED in the array to a specified color
 void fillAll(CRGB fillColor) {
-  for (byte i = 0; i < NUM_LEDS; i++) {
-    leds[i] = fillColor;
-  }
-}
-
-// Fade every LED in the array by a specified amount
-void fadeAll(byte fadeIncr) {
-  for (byte i = 0; i < NUM_LEDS; i++) {
-    leds[i] = leds[i].fadeToBlackBy(fadeIncr);
-  }
+  fill_solid(leds, NUM_LEDS, fillColor);
 }
 
 // Shift all pixels by one, right or left (0 or 1)
 void scrollArray(byte scrollDir) {
-  
-    byte scrollX = 0;
-    for (byte x = 1; x < kMatrixWidth; x++) {
-      if (scrollDir == 0) {
-        scrollX = kMatrixWidth - x;
-      } else if (scrollDir == 1) {
-        scrollX = x - 1;
-      }
-      
-      for (byte y = 0; y < kMatrixHeight; y++) {
-        leds[XY(scrollX,y)] = leds[XY(scrollX + scrollDir*2 - 1,y)];
-      }
-    } 
+  for (byte y = 0; y < kMatrixHeight; y++) {
+    shiftRow(y, scrollDir);
+  }
 }
 
 // Mirror right side of glasses from left
 void mirrorArray() {
-  for (byte x = 0; x < kMatrixWidth / 2; x++) {
-    for (byte y = 0; y < kMatrixHeight; y++) {
-      leds[XY(kMatrixWidth - x - 1, y)] = leds[XY(x, y)];
-    }
+  for (byte y = 0; y < kMatrixHeight; y++) {
+    mirrorRow(y);
   }
 }
 
@@ -81,102 +81,6 @@ void mirrorArray() {
 //   }
 // }
 
-CRGBPalette16 getRandomAudioPalette() {
-  switch (random8(8))
-  {
-  case 0:
-    return CRGBPalette16(CRGB::Red, CRGB::Orange, CRGB::Violet);
-  case 1:
-    return CRGBPalette16(CRGB::Cyan, CRGB::LightSeaGreen, CRGB::BlueViolet, CRGB::Red);
-  case 2:
-    return CRGBPalette16(CRGB::LightSkyBlue, CRGB::LightCoral, CRGB::MediumVioletRed);
-  case 4:
-    return CRGBPalette16(CRGB::Fuchsia, CRGB::DeepPink, CRGB::HotPink, CRGB::Salmon);
-  case 5:
-    return RainbowColors_p;
-  case 6:
-    return PartyColors_p;
-  case 7:
-    return HeatColors_p;
-  }
-}
-
-// Pick a random palette from a list
-void selectRandomAudioPalette() {
-  currentPalette = getRandomAudioPalette();
-}
-
-void selectRandomOverlayAudioPalette() {
-  currentOverlayPalette = getRandomAudioPalette();
-}
-
-void selectRandomNoisePalette() {
-
-  switch(random8(4)) {
-    case 0:
-    currentPalette = CRGBPalette16(CRGB::Black, CRGB::Red, CRGB::Black, CRGB::Blue);
-    break;
-    
-    case 1:
-    currentPalette = CRGBPalette16(CRGB::DarkGreen, CRGB::Black, CRGB::Green);
-    break;
-    
-    case 2:
-    currentPalette = CRGBPalette16(CRGB(0,0,8), CRGB(0,0,16), CRGB(0,0,32), CRGB::White);
-    break;
-    
-    case 3:
-    currentPalette = CRGBPalette16(CRGB(255,0,127), CRGB::Black, CRGB::OrangeRed);
-    break;
-    
-    case 5:
-    currentPalette = RainbowColors_p;
-    break;
-    
-    case 6:
-    currentPalette = PartyColors_p;
-    break;
-    
-    case 7:
-    currentPalette = HeatColors_p;
-    break;
-  }
-
-}
-
-// Interrupt normal operation to indicate that auto cycle mode has changed
-void confirmBlink(CRGB blinkColor, byte count) {
-
-  for (byte i = 0; i < count; i++) {
-    fillAll(blinkColor);
-    FastLED.show();
-    delay(200);
-    fillAll(CRGB::Black);
-    FastLED.show();
-    delay(200);
-  }
-
-}
-
-// write EEPROM value if it's different from stored value
-void updateEEPROM(byte location, byte value) {
-  if (EEPROM.read(location) != value) EEPROM.write(location, value);
-}
-
-// Write settings to EEPROM if necessary
-void checkEEPROM() {
-  if (eepromOutdated) {
-    if (currentMillis - eepromMillis > EEPROMDELAY) {
-      updateEEPROM(0, 99);
-      updateEEPROM(1, currentEffect);
-      updateEEPROM(2, autoCycle);
-      updateEEPROM(3, currentBrightness);
-      updateEEPROM(4, audioEnabled);
-      eepromOutdated = false;
-    }
-  }
-}
-
 
 #define MAX_DIMENSION ((kMatrixWidth>kMatrixHeight) ? kMatrixWidth : kMatrixHeight)
 uint8_t noise[MAX_DIMENSION][MAX_DIMENSION];
@@ -198,14 +102,15 @@ void fillnoise8() {
   nz += nspeed;
 }
 
-byte nextBrightness(boolean resetVal) {
-    const byte brightVals[6] = {32,64,96,160,224,255};
+#define BRIGHTNESSLEVELS 6
+const byte brightVals[BRIGHTNESSLEVELS] = {32,64,96,160,224,255};
 
+byte nextBrightness(boolean resetVal) {
     if (resetVal) {
       currentBrightness = STARTBRIGHTNESS;
     } else {
       currentBrightness++;
-      if (currentBrightness > sizeof(brightVals)/sizeof(brightVals[0])) currentBrightness = 0;
+      if (currentBrightness >= BRIGHTNESSLEVELS) currentBrightness = 0;
     }
 
   return brightVals[currentBrightness];
@@ -227,6 +132,17 @@ long mapToMillisAgo(long value, long fromLow, long fromHigh, long toMillisHigh)
   return map(value, fromLow, fromHigh, 0, toMillisHigh);
 }
 
+// CRC-8 with polynomial 0x07, for checking records that pass through Serial or EEPROM
+uint8_t crc8(const uint8_t* data, uint8_t len, uint8_t crc = 0) {
+  for (uint8_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
 // Print given array.
 void printArray(uint16_t* array, uint16_t arraySize) {
   for (uint16_t i = 0; i < arraySize; i++) {
@@ -270,9 +186,11 @@ void printArray(CircularBuffer<uint16_t, 20UL, uint8_t> array) {
 
 void printSampleTimes() {
   Serial.print("Sample times: ");
-  for (uint16_t i = 0; i < rollingPeaks.size(); i++) {
-    Serial.print(rollingPeaks[i]);
+  uint32_t peak = newestPeakMillis;
+  for (byte i = 0; i < peakCount; i++) {
+    Serial.print(peak);
     Serial.print(' ');
+    if (i + 1 < peakCount) peak -= peakGapBefore(i);
   }
   Serial.println();
 }